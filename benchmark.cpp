@@ -0,0 +1,380 @@
+#include "cfw.h"
+#include "canvas.h"
+#include "image_source.h"
+
+#include <sys/mman.h>
+#include <dirent.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Conversion throughput with cached and streaming stores, and what each costs the application's
+// working set, conversion into memory preferred on each NUMA node, playback of image files read
+// into a buffer versus streamed from a mapping, frame streaming to a local client, and the tiled
+// canvas against drawing each shape straight into the frame. Needs no display.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile uint64_t gSink;  // keeps the working set reads
+
+double ms(const Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+// Memory for one frame, untouched so a NUMA preference decides where it lands.
+struct Frame {
+  uint32_t* pixels;
+  size_t bytes;
+
+  Frame(const int width, const int height) : bytes(static_cast<size_t>(width) * height * 4) {
+    pixels = static_cast<uint32_t*>(mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (pixels == MAP_FAILED) {
+      std::cerr << "Failed to map a frame." << std::endl;
+      exit(1);
+    }
+  }
+  ~Frame() { munmap(pixels, bytes); }
+};
+
+uint64_t touch(const std::vector<uint64_t>& workingSet) {
+  uint64_t sum = 0;
+  for (const uint64_t v : workingSet) {
+    sum += v;
+  }
+  return sum;
+}
+
+void benchStores(const int width, const int height, const int frames) {
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+  for (size_t i = 0; i < rgb.size(); ++i) {
+    rgb[i] = static_cast<uint8_t>(i * 31);
+  }
+  Frame frame(width, height);
+  const cfw::Framebuffer fb{frame.pixels, width, height, width};
+  std::vector<uint64_t> workingSet((1U << 20U) / sizeof(uint64_t), 1);  // 1 MiB the application keeps hot
+
+  for (const cfw::Store store : {cfw::Store::Cached, cfw::Store::Streaming}) {
+    cfw::convertImage<cfw::format::RGB24, cfw::format::Native>(rgb.data(), width, height, fb, store);  // fault in
+    Clock::duration convert{}, reload{};
+    uint64_t sum = 0;
+    for (int i = 0; i < frames; ++i) {
+      sum += touch(workingSet);
+      const Clock::time_point t0 = Clock::now();
+      cfw::convertImage<cfw::format::RGB24, cfw::format::Native>(rgb.data(), width, height, fb, store);
+      const Clock::time_point t1 = Clock::now();
+      sum += touch(workingSet);
+      reload += Clock::now() - t1;
+      convert += t1 - t0;
+    }
+    gSink = sum;
+    const double perFrame = ms(convert) / frames;
+    printf("%5dx%-5d %-9s convert %7.2f ms  %6.2f GB/s written  working set reload %6.1f us\n", width, height,
+           store == cfw::Store::Cached ? "cached" : "streaming", perFrame,
+           static_cast<double>(frame.bytes) / perFrame / 1e6, ms(reload) * 1000.0 / frames);
+  }
+}
+
+std::vector<int> numaNodes() {
+  std::vector<int> nodes;
+  if (DIR* const dir = opendir("/sys/devices/system/node")) {
+    while (const dirent* const entry = readdir(dir)) {
+      if (std::strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+        nodes.push_back(std::atoi(entry->d_name + 4));
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  return nodes;
+}
+
+void benchNuma(const int width, const int height, const int frames) {
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3, 0x80);
+  for (const int node : numaNodes()) {
+    Frame frame(width, height);
+    const bool preferred = cfw::preferNumaNode(frame.pixels, frame.bytes, node);
+    const cfw::Framebuffer fb{frame.pixels, width, height, width};
+    cfw::convertImage<cfw::format::RGB24, cfw::format::Native>(rgb.data(), width, height, fb);
+    const Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < frames; ++i) {
+      cfw::convertImage<cfw::format::RGB24, cfw::format::Native>(rgb.data(), width, height, fb);
+    }
+    printf("node %d%s convert %7.2f ms\n", node, preferred ? "" : " (mbind failed)", ms(Clock::now() - t0) / frames);
+  }
+}
+
+// Stands in for a window in ImageFile/QoiDecoder::render().
+struct FrameSink {
+  cfw::Framebuffer fb;
+
+  template <class Src>
+  void renderRows(const uint8_t* data, const size_t stride, const int width, const int y, const int rows,
+                  const cfw::Store store) {
+    cfw::convertRows<Src, cfw::format::Native>(data, stride, width, y, rows, fb, store);
+  }
+};
+
+// Minimal QOI encoder for the test file: runs, index hits, small diffs and literal RGB.
+std::vector<uint8_t> encodeQoi(const uint8_t* rgb, const int width, const int height) {
+  std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+  for (const uint32_t v : {static_cast<uint32_t>(width), static_cast<uint32_t>(height)}) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      out.push_back(static_cast<uint8_t>(v >> static_cast<unsigned>(shift)));
+    }
+  }
+  out.push_back(3);
+  out.push_back(0);
+  uint8_t index[64][3] = {};
+  uint8_t prev[3] = {0, 0, 0};
+  int run = 0;
+  const size_t pixels = static_cast<size_t>(width) * height;
+  for (size_t i = 0; i < pixels; ++i) {
+    const uint8_t* px = rgb + i * 3;
+    if (std::memcmp(px, prev, 3) == 0) {
+      if (++run == 62 || i + 1 == pixels) {
+        out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+      run = 0;
+    }
+    const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+    const int dr = px[0] - prev[0], dg = px[1] - prev[1], db = px[2] - prev[2];
+    if (std::memcmp(index[hash], px, 3) == 0) {
+      out.push_back(static_cast<uint8_t>(hash));
+    } else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+      out.push_back(static_cast<uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+    } else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+      out.push_back(static_cast<uint8_t>(0x80 | (dg + 32)));
+      out.push_back(static_cast<uint8_t>((dr - dg + 8) << 4 | (db - dg + 8)));
+    } else {
+      out.insert(out.end(), {0xFE, px[0], px[1], px[2]});
+    }
+    std::memcpy(index[hash], px, 3);
+    std::memcpy(prev, px, 3);
+  }
+  out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+  return out;
+}
+
+void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+  FILE* const file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr || std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+    std::cerr << "Failed to write " << path << "." << std::endl;
+    exit(1);
+  }
+  std::fclose(file);
+}
+
+void benchSources(const std::string& dir, const int width, const int height, const int frames) {
+  const size_t frameBytes = static_cast<size_t>(width) * height * 3;
+  std::vector<uint8_t> rgb(frameBytes);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      uint8_t* const px = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+      px[0] = static_cast<uint8_t>(x / 4);
+      px[1] = static_cast<uint8_t>(y / 4);
+      px[2] = static_cast<uint8_t>((x ^ y) & 0xC0);
+    }
+  }
+  const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+  std::vector<uint8_t> ppm;
+  for (int i = 0; i < frames; ++i) {
+    ppm.insert(ppm.end(), header.begin(), header.end());
+    ppm.insert(ppm.end(), rgb.begin(), rgb.end());
+  }
+  const std::string ppmPath = dir + "/cfw_bench.ppm";
+  const std::string qoiPath = dir + "/cfw_bench.qoi";
+  writeFile(ppmPath, ppm);
+  writeFile(qoiPath, encodeQoi(rgb.data(), width, height));
+  ppm = {};
+
+  Frame frame(width, height);
+  FrameSink sink{{frame.pixels, width, height, width}};
+
+  // Read each frame into a buffer, then convert it, as an application without image_source.h does.
+  Clock::time_point t0 = Clock::now();
+  if (FILE* const file = std::fopen(ppmPath.c_str(), "rb")) {
+    std::vector<uint8_t> buffer(frameBytes);
+    for (int i = 0; i < frames; ++i) {
+      std::fseek(file, static_cast<long>(header.size()), SEEK_CUR);
+      if (std::fread(buffer.data(), 1, frameBytes, file) != frameBytes) {
+        break;
+      }
+      cfw::convertImage<cfw::format::RGB24, cfw::format::Native>(buffer.data(), width, height, sink.fb);
+    }
+    std::fclose(file);
+  }
+  const double readMs = ms(Clock::now() - t0) / frames;
+
+  t0 = Clock::now();
+  {
+    const cfw::ImageFile file(ppmPath);
+    for (int i = 0; i < file.frames(); ++i) {
+      file.render(sink, i);
+    }
+  }
+  const double mappedMs = ms(Clock::now() - t0) / frames;
+
+  cfw::QoiDecoder qoi(qoiPath);
+  t0 = Clock::now();
+  for (int i = 0; i < frames; ++i) {
+    qoi.render(sink);
+  }
+  const double qoiMs = ms(Clock::now() - t0) / frames;
+
+  printf("%5dx%-5d read+convert %7.2f ms  mapped %7.2f ms  qoi %7.2f ms per frame\n", width, height, readMs,
+         mappedMs, qoiMs);
+  std::remove(ppmPath.c_str());
+  std::remove(qoiPath.c_str());
+}
+
+// A 1/4 screen box moves over a static background; the client thread mirrors the stream.
+void benchStream(const std::string& dir, const int width, const int height, const int frames) {
+  const std::string path = dir + "/cfw_bench.sock";
+  cfw::StreamServer server(path);
+  if (!server.ok()) {
+    return;
+  }
+  std::atomic<uint64_t> wire{0};
+  std::vector<uint32_t> mirror;
+  std::thread client([&]() {
+    cfw::StreamReader reader(path);
+    while (reader.ok() && reader.read()) {
+      wire = reader.wireBytes();
+      if (reader.sequence() == static_cast<uint32_t>(frames + 1)) {  // the last frame
+        break;
+      }
+    }
+    mirror.assign(reader.pixels(), reader.pixels() + static_cast<size_t>(reader.width()) * reader.height());
+  });
+  while (server.clients() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (i / width / 32 + i % width / 32) % 2 != 0 ? 0x00304050U : 0x00405060U;
+  }
+  const cfw::Framebuffer fb{pixels.data(), width, height, width};
+  server.publish(fb, {0, 0, width, height}, {});
+  const int box = width / 4;
+  Clock::duration publish{};
+  for (int i = 0; i < frames; ++i) {
+    const cfw::Rect area{(i * 37) % (width - box), (i * 23) % (height - box), box, box};
+    for (int y = area.y; y < area.y + area.height; ++y) {
+      std::fill_n(fb.row(y) + area.x, area.width, 0x00FF0000U + i * 0x010203U);
+    }
+    const Clock::time_point t0 = Clock::now();
+    server.publish(fb, area, {});
+    publish += Clock::now() - t0;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  client.join();
+
+  const bool match = mirror == pixels;
+  printf("%5dx%-5d publish %6.3f ms  %6.1f tiles  %7.1f KB sent per frame  %llu coalesced  mirror %s\n", width,
+         height, ms(publish) / frames, static_cast<double>(server.tilesChanged()) / (frames + 1),
+         static_cast<double>(wire) / (frames + 1) / 1e3, static_cast<unsigned long long>(server.coalesced()),
+         match ? "matches" : "DIFFERS");
+}
+
+struct Circle {
+  float x, y, r;
+  uint32_t color;
+};
+
+// Each shape blended straight into the frame, one pass over its pixels per shape.
+void drawDirect(const cfw::Framebuffer& fb, const std::vector<Circle>& circles) {
+  for (int y = 0; y < fb.height; ++y) {
+    std::fill_n(fb.row(y), fb.width, 0x00202020U);
+  }
+  for (const Circle& c : circles) {
+    const int top = std::max(0, static_cast<int>(c.y - c.r));
+    const int bottom = std::min(fb.height, static_cast<int>(c.y + c.r) + 1);
+    for (int y = top; y < bottom; ++y) {
+      const float dy = static_cast<float>(y) + 0.5F - c.y;
+      const float d2 = c.r * c.r - dy * dy;
+      if (d2 < 0.0F) {
+        continue;
+      }
+      const float dx = std::sqrt(d2);
+      const int x0 = std::max(0, static_cast<int>(std::ceil(c.x - dx - 0.5F)));
+      const int x1 = std::min(fb.width, static_cast<int>(std::ceil(c.x + dx - 0.5F)));
+      uint32_t* const row = fb.row(y);
+      for (int x = x0; x < x1; ++x) {
+        row[x] = cfw::blend::over(c.color, row[x]) & 0x00ffffffU;
+      }
+    }
+  }
+}
+
+void benchCanvas(const int width, const int height, const int shapes, const int frames) {
+  std::vector<Circle> circles;
+  uint32_t seed = 1;
+  const auto next = [&seed](const uint32_t range) {
+    seed = seed * 1664525U + 1013904223U;
+    return (seed >> 8U) % range;
+  };
+  for (int i = 0; i < shapes; ++i) {
+    const uint32_t alpha = 0x80;
+    circles.push_back({static_cast<float>(next(width)), static_cast<float>(next(height)),
+                       static_cast<float>(8 + next(72)),
+                       alpha << 24U | next(alpha) << 16U | next(alpha) << 8U | next(alpha)});
+  }
+  Frame frame(width, height);
+  const cfw::Framebuffer fb{frame.pixels, width, height, width};
+
+  Clock::time_point t0 = Clock::now();
+  for (int i = 0; i < frames; ++i) {
+    drawDirect(fb, circles);
+  }
+  printf("%5dx%-5d %d circles  direct %7.2f ms", width, height, shapes, ms(Clock::now() - t0) / frames);
+
+  for (const unsigned int threads : {1U, 0U}) {
+    cfw::TiledCanvas canvas(width, height, threads);
+    t0 = Clock::now();
+    for (int i = 0; i < frames; ++i) {
+      canvas.clear(0x00202020U);
+      for (const Circle& c : circles) {
+        canvas.fillCircle(c.x, c.y, c.r, c.color);
+      }
+      canvas.resolve(fb);
+    }
+    printf("  tiled x%u %7.2f ms", canvas.threads(), ms(Clock::now() - t0) / frames);
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int frames = argc > 1 ? std::atoi(argv[1]) : 20;
+
+  printf("Stores (streaming threshold %zu MiB):\n", cfw::kStreamingStoreBytes >> 20U);
+  benchStores(1280, 720, frames);
+  benchStores(1920, 1080, frames);
+  benchStores(3840, 2160, frames);
+  benchStores(7680, 4320, frames);
+
+  printf("\nNUMA placement of an 8K frame, converted from this thread:\n");
+  benchNuma(7680, 4320, frames);
+
+  const char* const tmp = std::getenv("TMPDIR");
+  printf("\nPlayback of a PPM sequence from the page cache, and a QOI still:\n");
+  benchSources(tmp != nullptr ? tmp : "/tmp", 1920, 1080, frames);
+  benchSources(tmp != nullptr ? tmp : "/tmp", 3840, 2160, frames);
+
+  printf("\nStreaming a moving box to a local client:\n");
+  benchStream(tmp != nullptr ? tmp : "/tmp", 1920, 1080, frames * 5);
+
+  printf("\nTranslucent circles, tiled canvas against drawing each into the frame:\n");
+  benchCanvas(1920, 1080, 2000, frames);
+  benchCanvas(3840, 2160, 8000, frames);
+  return 0;
+}
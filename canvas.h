@@ -0,0 +1,345 @@
+#ifndef CFW_CANVAS_H
+#define CFW_CANVAS_H
+
+#include "compositor.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cfw {
+
+// Records draw commands for a frame and rasterizes them in parallel. The frame is split into
+// 64x64 tiles (16 KiB, held in L1 while drawn); each command is binned into the tiles it touches.
+// resolve() hands out bands of one tile row to a worker pool: a worker draws each tile of the band
+// into its own buffer, then writes the band to the framebuffer row by row, so the window's image
+// is written sequentially once per frame instead of once per overlapping shape. Tiles no command
+// touches are left alone and are not part of the damage.
+//
+// Colors are premultiplied 0xAARRGGBB as in compositor.h; translucent shapes blend over what
+// is below them, starting from the framebuffer's content unless an opaque rectangle covers the tile.
+// Tiles are native 0x00RRGGBB; other framebuffer layouts are converted on the way in and out.
+class TiledCanvas {
+public:
+    static constexpr int kTileSize = 64;
+
+private:
+    enum class Shape : uint8_t { Rect, Circle, Triangle };
+
+    struct Command {
+        Shape shape;
+        uint32_t color;
+        Rect bounds;  // pixels possibly touched, clipped to the canvas
+        float v[6];
+    };
+
+    struct Bin {
+        std::vector<uint32_t> commands;
+        bool covered{false};  // the first command paints the whole tile opaquely
+    };
+
+    int mWidth;
+    int mHeight;
+    int mColumns;
+    int mRows;
+    std::vector<Command> mCommands;
+    std::vector<Bin> mBins;
+
+    // Worker pool, the thread calling resolve() takes part as worker 0.
+    std::vector<std::thread> mWorkers;
+    std::vector<std::vector<uint32_t>> mBands;  // per worker, a band of tile buffers
+    std::mutex mMutex;
+    std::condition_variable mStart;
+    std::condition_variable mDone;
+    uint64_t mGeneration{0};
+    int mBusy{0};
+    bool mStopping{false};
+    std::atomic<int> mNextBand{0};
+    Framebuffer mTarget;
+
+    static bool opaque(const uint32_t color) { return color >> 24U == 0xffU; }
+
+    Rect tileRect(const int column, const int row) const {
+        return Rect{column * kTileSize, row * kTileSize, kTileSize, kTileSize}.intersect({0, 0, mWidth, mHeight});
+    }
+
+    void add(const Command& command) {
+        if (command.bounds.empty() || command.color >> 24U == 0) {
+            return;
+        }
+        const auto index = static_cast<uint32_t>(mCommands.size());
+        mCommands.push_back(command);
+        const Rect& b = command.bounds;
+        for (int row = b.y / kTileSize; row <= (b.y + b.height - 1) / kTileSize; ++row) {
+            for (int column = b.x / kTileSize; column <= (b.x + b.width - 1) / kTileSize; ++column) {
+                const Rect tile = tileRect(column, row);
+                if (command.shape == Shape::Circle) {  // skip tiles only the bounding box reaches
+                    const float dx = std::max({tile.x - command.v[0], 0.0F, command.v[0] - (tile.x + tile.width)});
+                    const float dy = std::max({tile.y - command.v[1], 0.0F, command.v[1] - (tile.y + tile.height)});
+                    if (dx * dx + dy * dy > command.v[2] * command.v[2]) {
+                        continue;
+                    }
+                }
+                Bin& bin = mBins[static_cast<size_t>(row) * mColumns + column];
+                if (command.shape == Shape::Rect && opaque(command.color) && b.intersect(tile).width == tile.width &&
+                    b.intersect(tile).height == tile.height) {
+                    bin.commands.clear();  // everything before is hidden
+                    bin.covered = true;
+                }
+                bin.commands.push_back(index);
+            }
+        }
+    }
+
+    static void fillSpan(uint32_t* dst, int count, const uint32_t color) {
+        if (opaque(color)) {
+            std::fill_n(dst, count, color & 0x00ffffffU);
+            return;
+        }
+        for (; count > 0; --count, ++dst) {
+            *dst = blend::over(color, *dst) & 0x00ffffffU;
+        }
+    }
+
+    // Draw a command into tile, whose pixel (0, 0) is canvas pixel (area.x, area.y).
+    static void rasterize(const Command& c, const Framebuffer& tile, const Rect& area) {
+        const Rect clip = c.bounds.intersect(area);
+        for (int y = clip.y; y < clip.y + clip.height; ++y) {
+            float lo = static_cast<float>(clip.x);
+            float hi = static_cast<float>(clip.x + clip.width);
+            const float yc = static_cast<float>(y) + 0.5F;
+            if (c.shape == Shape::Circle) {
+                const float dy = yc - c.v[1];
+                const float d2 = c.v[2] * c.v[2] - dy * dy;
+                if (d2 < 0.0F) {
+                    continue;
+                }
+                const float dx = std::sqrt(d2);
+                lo = std::max(lo, c.v[0] - dx);
+                hi = std::min(hi, c.v[0] + dx);
+            } else if (c.shape == Shape::Triangle) {
+                // fillTriangle() orders the corners so that, for every edge, the inside is where
+                // (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0) >= 0.
+                for (int e = 0; e < 3; ++e) {
+                    const float x0 = c.v[e * 2], y0 = c.v[e * 2 + 1];
+                    const float x1 = c.v[(e * 2 + 2) % 6], y1 = c.v[(e * 2 + 3) % 6];
+                    const float a = (x1 - x0) * (yc - y0) + (y1 - y0) * x0;
+                    const float b = y1 - y0;
+                    if (b > 0.0F) {
+                        hi = std::min(hi, a / b);
+                    } else if (b < 0.0F) {
+                        lo = std::max(lo, a / b);
+                    } else if (a < 0.0F) {
+                        hi = lo;
+                    }
+                }
+            }
+            // Pixels whose centers lie in [lo, hi).
+            const int x0 = static_cast<int>(std::ceil(std::max(lo, static_cast<float>(clip.x)) - 0.5F));
+            const int x1 = static_cast<int>(std::ceil(std::min(hi, static_cast<float>(clip.x + clip.width)) - 0.5F));
+            if (x1 > x0) {
+                fillSpan(tile.row(y - area.y) + (x0 - area.x), x1 - x0, c.color);
+            }
+        }
+    }
+
+    void drawBand(const int row, uint32_t* const buffer) {
+        const Rect band = Rect{0, row * kTileSize, mWidth, kTileSize}.intersect({0, 0, mTarget.width, mTarget.height});
+        if (band.empty()) {
+            return;
+        }
+        const Bin* const bins = &mBins[static_cast<size_t>(row) * mColumns];
+        const int columns = std::min(mColumns, (band.width + kTileSize - 1) / kTileSize);
+        for (int column = 0; column < columns; ++column) {
+            if (bins[column].commands.empty()) {
+                continue;
+            }
+            const Rect area = tileRect(column, row).intersect(band);
+            const Framebuffer tile{buffer + column * kTileSize * kTileSize, area.width, area.height, kTileSize};
+            if (!bins[column].covered) {
+                for (int y = 0; y < area.height; ++y) {
+                    const uint32_t* const src = mTarget.row(area.y + y) + area.x;
+                    if (mTarget.native()) {
+                        std::copy_n(src, area.width, tile.row(y));
+                    } else {
+                        std::transform(src, src + area.width, tile.row(y),
+                                       [this](const uint32_t p) { return mTarget.rgb(p); });
+                    }
+                }
+            }
+            for (const uint32_t index : bins[column].commands) {
+                rasterize(mCommands[index], tile, area);
+            }
+        }
+        // Row-major resolve: each framebuffer row of the band is written left to right.
+        for (int y = 0; y < band.height; ++y) {
+            uint32_t* const dst = mTarget.row(band.y + y);
+            for (int column = 0; column < columns; ++column) {
+                if (!bins[column].commands.empty()) {
+                    const int x = column * kTileSize;
+                    const uint32_t* const src = buffer + column * kTileSize * kTileSize + y * kTileSize;
+                    const int count = std::min(kTileSize, band.width - x);
+                    if (mTarget.native()) {
+                        std::copy_n(src, count, dst + x);
+                    } else {
+                        std::transform(src, src + count, dst + x, [this](const uint32_t p) { return mTarget.pixel(p); });
+                    }
+                }
+            }
+        }
+    }
+
+    void drawBands(const int worker) {
+        for (int row = mNextBand++; row < mRows; row = mNextBand++) {
+            drawBand(row, mBands[worker].data());
+        }
+    }
+
+    void workerThread(const int worker) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;) {
+            mStart.wait(lock, [&] { return mStopping || mGeneration != seen; });
+            if (mStopping) {
+                return;
+            }
+            seen = mGeneration;
+            lock.unlock();
+            drawBands(worker);
+            lock.lock();
+            if (--mBusy == 0) {
+                mDone.notify_one();
+            }
+        }
+    }
+
+public:
+    // threads includes the caller of resolve(), 0 for one per hardware thread.
+    TiledCanvas(const int width, const int height, unsigned int threads = 0)
+        : mWidth(std::max(0, width)),
+          mHeight(std::max(0, height)),
+          mColumns((mWidth + kTileSize - 1) / kTileSize),
+          mRows((mHeight + kTileSize - 1) / kTileSize),
+          mBins(static_cast<size_t>(mColumns) * mRows) {
+        if (threads == 0) {
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        threads = std::min(threads, static_cast<unsigned int>(std::max(1, mRows)));
+        mBands.resize(threads, std::vector<uint32_t>(static_cast<size_t>(mColumns) * kTileSize * kTileSize));
+        for (unsigned int i = 1; i < threads; ++i) {
+            mWorkers.emplace_back(&TiledCanvas::workerThread, this, static_cast<int>(i));
+        }
+    }
+
+    ~TiledCanvas() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mStart.notify_all();
+        for (std::thread& worker : mWorkers) {
+            worker.join();
+        }
+    }
+
+    TiledCanvas(const TiledCanvas&) = delete;
+    TiledCanvas(TiledCanvas&&) = delete;
+    void operator=(const TiledCanvas&) = delete;
+    void operator=(TiledCanvas&&) = delete;
+
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    unsigned int threads() const { return static_cast<unsigned int>(mBands.size()); }
+
+    void clear(const uint32_t color) { fillRect({0, 0, mWidth, mHeight}, color | 0xff000000U); }
+
+    void fillRect(const Rect& rect, const uint32_t color) {
+        add({Shape::Rect, color, rect.intersect({0, 0, mWidth, mHeight}), {}});
+    }
+
+    void fillCircle(const float cx, const float cy, const float radius, const uint32_t color) {
+        const Rect bounds{static_cast<int>(std::floor(cx - radius)), static_cast<int>(std::floor(cy - radius)),
+                          static_cast<int>(std::ceil(2 * radius)) + 2, static_cast<int>(std::ceil(2 * radius)) + 2};
+        add({Shape::Circle, color, bounds.intersect({0, 0, mWidth, mHeight}), {cx, cy, radius}});
+    }
+
+    void fillTriangle(const float x0, const float y0, float x1, float y1, float x2, float y2, const uint32_t color) {
+        if ((x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0) < 0.0F) {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+        }
+        const int left = static_cast<int>(std::floor(std::min({x0, x1, x2})));
+        const int top = static_cast<int>(std::floor(std::min({y0, y1, y2})));
+        const Rect bounds{left, top, static_cast<int>(std::ceil(std::max({x0, x1, x2}))) - left + 1,
+                          static_cast<int>(std::ceil(std::max({y0, y1, y2}))) - top + 1};
+        add({Shape::Triangle, color, bounds.intersect({0, 0, mWidth, mHeight}), {x0, y0, x1, y1, x2, y2}});
+    }
+
+    // A line width pixels wide, as two triangles.
+    void line(const float x0, const float y0, const float x1, const float y1, const float width,
+              const uint32_t color) {
+        const float length = std::hypot(x1 - x0, y1 - y0);
+        if (length == 0.0F) {
+            return;
+        }
+        const float nx = (y0 - y1) / length * width * 0.5F;
+        const float ny = (x1 - x0) / length * width * 0.5F;
+        fillTriangle(x0 + nx, y0 + ny, x1 + nx, y1 + ny, x1 - nx, y1 - ny, color);
+        fillTriangle(x0 + nx, y0 + ny, x1 - nx, y1 - ny, x0 - nx, y0 - ny, color);
+    }
+
+    // Commands recorded since the last resolve().
+    size_t commands() const { return mCommands.size(); }
+
+    // Draw the recorded commands into fb and start a new frame. Returns the bounds of the tiles
+    // drawn, for paint(const Rect&).
+    Rect resolve(const Framebuffer& fb) {
+        Rect damage;
+        for (int row = 0; row < mRows; ++row) {
+            for (int column = 0; column < mColumns; ++column) {
+                if (!mBins[static_cast<size_t>(row) * mColumns + column].commands.empty()) {
+                    damage = damage.unite(tileRect(column, row));
+                }
+            }
+        }
+        damage = damage.intersect(fb.bounds());
+        if (!damage.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mTarget = fb;
+                mNextBand = damage.y / kTileSize;
+                mBusy = static_cast<int>(mWorkers.size());
+                ++mGeneration;
+            }
+            mStart.notify_all();
+            drawBands(0);
+            std::unique_lock<std::mutex> lock(mMutex);
+            mDone.wait(lock, [this] { return mBusy == 0; });
+        }
+        mCommands.clear();
+        for (Bin& bin : mBins) {
+            bin.commands.clear();
+            bin.covered = false;
+        }
+        return damage;
+    }
+
+    // Resolve into a window's image and present the drawn tiles.
+    template <class Win>
+    void present(Win& window) {
+        const Rect damage = resolve(window.framebuffer());
+        if (!damage.empty()) {
+            window.paint(damage);
+        }
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_CANVAS_H
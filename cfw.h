@@ -3,15 +3,31 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>  //memcpy()
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 
+#include "color.h"
+#include "formats.h"
+#include "framebuffer.h"
+#include "hud.h"
+#include "input_log.h"
+#include "latency.h"
+#include "palette.h"
+#include "pointer.h"
+#include "recorder.h"
+#include "snapshot.h"
+
 #define OS_UNIX 1
 #define OS_WINDOWS 2
 
@@ -41,6 +57,28 @@ enum class Keys {
     // clang-format on
 };
 
+class DisplayContext;  // defined by the backend
+
+// Filter for setScaledPresent().
+enum class ScaleFilter {
+    Nearest,
+    Bilinear,
+};
+
+// Creation options, see the Window constructor taking them.
+struct WindowOptions {
+    // Return from the constructor right away instead of waiting for the window to be mapped and
+    // exposed. The window can be rendered to immediately, frames before it is ready are dropped.
+    bool async{false};
+    // Called once, from the event thread, when the window is first mapped and exposed.
+    std::function<void()> onReady;
+    // Display connection, event thread and locks to use. Windows without one share a default
+    // context; give windows rendered from different threads their own to avoid contention.
+    std::shared_ptr<DisplayContext> context;
+    // NUMA node for the backing store, -1 for the node of the thread that first renders into it.
+    int numaNode{-1};
+};
+
 class WindowBase {
 protected:                 // common
     char* mWindowTitle;  // TODO: std::string
@@ -57,10 +95,29 @@ protected:                 // common
 
     bool mIsHidden;
 
+    Hud mHud;
+    Keys mHudHotkey;
+    std::unique_ptr<Recorder> mRecorder;
+    std::mutex mInputRecorderMutex;  // start/stop run on the app thread, dispatch on the event thread
+    std::unique_ptr<InputRecorder> mInputRecorder;
+
+    static constexpr size_t kInputStampHistory = 256;
+    std::mutex mInputStampMutex;
+    std::array<InputStamp, kInputStampHistory> mInputStamps{};
+    uint64_t mLastInputId{0};
+    std::atomic<std::chrono::steady_clock::rep> mTaggedInput{0};  // arrival of the input the next frame answers
+    LatencyHistogram mInputLatency;
+
+    std::unique_ptr<ColorKernel> mColorKernel;  // fused into render() when set
+    std::weak_ptr<SnapshotState> mSnapshot;      // the latest snapshot, until the image is written
+
     std::function<void(Keys, bool)> mKeyboardCallback;
     std::function<void(const char*)> mCharCallback;
     std::function<void(uint32_t, uint32_t, uint32_t, int32_t)> mMouseCallback;
     std::function<void(void)> mCloseCallback;
+    std::function<void(const InputEvent&)> mEventCallback;
+    std::function<void(const PointerSample*, size_t)> mPointerCallback;
+    PointerBatcher mPointerBatch;
 
 public:  // common
 
@@ -76,7 +133,8 @@ public:  // common
           mMousePosY(-1),
           mMouseButtonState(0),
           mMouseWheelStatus(0),
-          mIsHidden(true) {}
+          mIsHidden(true),
+          mHudHotkey(Keys::F12) {}
 
     WindowBase(const WindowBase&) = delete;
     WindowBase(WindowBase&&) = delete;
@@ -103,14 +161,198 @@ public:  // common
         mCloseCallback = std::forward<Func>(func);
     }
 
+    // Every key, char, mouse and close event as one InputEvent, in dispatch order, before the
+    // specific callbacks, with arrival set to steady_clock time in nanoseconds. Used by coro.h.
+    template <class Func>
+    void setEventCallback(Func&& func) {
+        mEventCallback = std::forward<Func>(func);
+    }
+
+    // Timestamped pointer samples, delivered in batches: one call per batch of window system
+    // events. Uses XInput2 subpixel motion and smooth scrolling when built with it.
+    template <class Func>
+    void setPointerCallback(Func&& func) {
+        mPointerCallback = std::forward<Func>(func);
+    }
+
+    // How samples within one batch are merged, bucketMs applies to Coalescing::TimeBucketed.
+    void setPointerCoalescing(const Coalescing mode, const uint32_t bucketMs = 4) {
+        mPointerBatch.setMode(mode, bucketMs);
+    }
+
+    // Performance overlay, also enabled by CFW_HUD=1 in the environment.
+    void setHudEnabled(const bool enabled) { mHud.setEnabled(enabled); }
+    bool hudEnabled() const { return mHud.enabled(); }
+
+    // Key that toggles the overlay, Keys::NUM_KEYS disables the hotkey.
+    void setHudHotkey(const Keys key) { mHudHotkey = key; }
+
+    // Record every presented frame on a background writer thread. Start and stop from the thread that paints.
+    bool startRecording(const std::string& path, const Recorder::Format format = Recorder::Format::Y4M,
+                        const int fps = 60) {
+        mRecorder = std::make_unique<Recorder>(path, format, mDataWidth, mDataHeight, fps);
+        return !mRecorder->failed();
+    }
+
+    void stopRecording() { mRecorder.reset(); }
+
+    // Captured/dropped frame counters of the running recording, nullptr if not recording.
+    const Recorder* recorder() const { return mRecorder.get(); }
+
+    // Log every dispatched key, char, mouse and close event with its time, see input_log.h.
+    bool startInputRecording(const std::string& path) {
+        std::unique_ptr<InputRecorder> recorder = std::make_unique<InputRecorder>(path);
+        const bool ok = recorder->ok();
+        if (!ok) {
+            recorder.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mInputRecorderMutex);
+            mInputRecorder.swap(recorder);
+        }
+        return ok;  // the previous recorder, if any, is flushed and closed here, outside the lock
+    }
+
+    void stopInputRecording() {
+        std::unique_ptr<InputRecorder> recorder;
+        {
+            std::lock_guard<std::mutex> lock(mInputRecorderMutex);
+            mInputRecorder.swap(recorder);
+        }
+    }
+
+    // Deliver a recorded event to the callbacks as if it came from the window system.
+    void injectInput(const InputEvent& event) {
+        switch (event.type) {
+            case InputEvent::Type::Key:
+                dispatchKeyCallback(static_cast<Keys>(event.key), event.pressed);
+                break;
+            case InputEvent::Type::Char:
+                setChar(event.text);
+                break;
+            case InputEvent::Type::Mouse:
+                mMousePosX = static_cast<int_fast16_t>(event.x);
+                mMousePosY = static_cast<int_fast16_t>(event.y);
+                mMouseButtonState = static_cast<uint_fast8_t>(event.buttons);
+                mMouseWheelStatus = event.wheel;
+                dispatchMouseCallback();
+                break;
+            case InputEvent::Type::Close:
+                dispatchCloseCallback();
+                break;
+        }
+    }
+
+    // Id of the most recent input event. Read it from a callback to know which event is being handled.
+    uint64_t lastInputId() {
+        std::lock_guard<std::mutex> lock(mInputStampMutex);
+        return mLastInputId;
+    }
+
+    // Arrival times of one of the last few hundred input events.
+    bool inputStamp(const uint64_t id, InputStamp& stamp) {
+        std::lock_guard<std::mutex> lock(mInputStampMutex);
+        const InputStamp& entry = mInputStamps[id % kInputStampHistory];
+        if (id == 0 || entry.id != id) {
+            return false;
+        }
+        stamp = entry;
+        return true;
+    }
+
+    // Mark the next paint() as the response to input event id. When its put has completed the
+    // time since the event arrived is added to inputLatency().
+    void tagFrame(const uint64_t inputId) {
+        InputStamp stamp;
+        if (inputStamp(inputId, stamp)) {
+            std::chrono::steady_clock::rep idle = 0;
+            mTaggedInput.compare_exchange_strong(idle, stamp.arrival.time_since_epoch().count());
+        }
+    }
+
+    const LatencyHistogram& inputLatency() const { return mInputLatency; }
+    void resetInputLatency() { mInputLatency.reset(); }
+
+    // Replay a log on the calling thread, on its original timeline or as fast as possible.
+    size_t replayInput(const InputReplay& replay, const InputReplay::Timing timing = InputReplay::Timing::Original) {
+        return replay.run([this](const InputEvent& event) { injectInput(event); }, timing);
+    }
+
 protected:  // common
+    // Called by the backend when an input event arrives, before it is dispatched.
+    void stampInput(const uint32_t serverTime) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mInputStampMutex);
+        ++mLastInputId;
+        mInputStamps[mLastInputId % kInputStampHistory] = {mLastInputId, serverTime, now};
+    }
+
+    // Arrival time of the tagged input, claimed by the backend when it issues the put. Zero if none.
+    std::chrono::steady_clock::rep takeTaggedInput() { return mTaggedInput.exchange(0); }
+
+    void inputPresented(const std::chrono::steady_clock::rep arrival) {
+        using Clock = std::chrono::steady_clock;
+        mInputLatency.add(Clock::now() - Clock::time_point(Clock::duration(arrival)));
+    }
+
+    template<typename Write>
+    void recordInput(Write write) {
+        std::lock_guard<std::mutex> lock(mInputRecorderMutex);
+        if (mInputRecorder) {
+            write(*mInputRecorder);
+        }
+    }
+
+    void dispatchEvent(InputEvent& event) {
+        if (mEventCallback) {
+            event.arrival = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+            mEventCallback(event);
+        }
+    }
+
+    void dispatchKeyCallback(const Keys key, const bool isPressed) {
+        recordInput([&](InputRecorder& recorder) { recorder.key(static_cast<uint8_t>(key), isPressed); });
+        if (mEventCallback) {
+            InputEvent event;
+            event.type = InputEvent::Type::Key;
+            event.key = static_cast<uint8_t>(key);
+            event.pressed = isPressed;
+            dispatchEvent(event);
+        }
+        if (key == mHudHotkey && isPressed) {
+            mHud.toggle();
+        }
+        if (mKeyboardCallback) {
+            mKeyboardCallback(key, isPressed);
+        }
+    }
+
     void dispatchMouseCallback() {
+        recordInput([&](InputRecorder& recorder) {
+            recorder.mouse(mMousePosX, mMousePosY, mMouseButtonState, mMouseWheelStatus);
+        });
+        if (mEventCallback) {
+            InputEvent event;
+            event.type = InputEvent::Type::Mouse;
+            event.x = static_cast<int32_t>(mMousePosX);
+            event.y = static_cast<int32_t>(mMousePosY);
+            event.buttons = mMouseButtonState;
+            event.wheel = static_cast<int32_t>(mMouseWheelStatus);
+            dispatchEvent(event);
+        }
         if (mMouseCallback) {
             mMouseCallback(mMousePosX, mMousePosY, mMouseButtonState, mMouseWheelStatus);
         }
     }
 
     void dispatchCloseCallback() {
+        recordInput([&](InputRecorder& recorder) { recorder.close(); });
+        if (mEventCallback) {
+            InputEvent event;
+            event.type = InputEvent::Type::Close;
+            dispatchEvent(event);
+        }
         if (mCloseCallback) {
             mCloseCallback();
         }
@@ -127,8 +369,44 @@ protected:  // common
 
     void setMouseWheelState(const int_fast32_t amplitude) { mMouseWheelStatus += amplitude; }
 
+    void addPointerSample(const PointerSample& sample) {
+        if (mPointerCallback) {
+            mPointerBatch.add(sample);
+        }
+    }
+
+    void flushPointerSamples() {
+        if (mPointerCallback) {
+            mPointerBatch.flush(mPointerCallback);
+        }
+    }
+
+
+    // Copy-on-write for snapshot(), called by the backends before anything writes the image.
+    void detachSnapshot() {
+        if (const std::shared_ptr<SnapshotState> state = mSnapshot.lock()) {
+            state->detach();
+        }
+        mSnapshot.reset();
+    }
+
+    Snapshot makeSnapshot(const Framebuffer& image) {
+        std::shared_ptr<SnapshotState> state = mSnapshot.lock();
+        if (!state) {
+            state = std::make_shared<SnapshotState>(image);
+            mSnapshot = state;
+        }
+        return Snapshot(state);
+    }
 
     void setChar(const char* chars) {
+        recordInput([&](InputRecorder& recorder) { recorder.text(chars); });
+        if (mEventCallback) {
+            InputEvent event;
+            event.type = InputEvent::Type::Char;
+            std::strncpy(event.text, chars, sizeof(event.text) - 1);
+            dispatchEvent(event);
+        }
         if (mCharCallback) {
             mCharCallback(chars);
         }
@@ -153,4 +431,58 @@ namespace cfw {
 
 #endif
 
+namespace cfw {
+
+// Window with the pixel conversion fixed at compile time, for deployments where the display
+// format is known. The constructor verifies that the runtime visual matches DstFormat.
+template <class SrcFormat, class DstFormat = format::Native>
+class BasicWindow : public Window {
+    static_assert(SrcFormat::kIsSource, "SrcFormat must be a cfw::format source format");
+    static_assert(DstFormat::kIsDestination, "DstFormat must be a cfw::format destination format");
+
+    void checkVisual() const {
+        if (!DstFormat::matches(visualFormat())) {
+            std::cerr << "Display visual does not match the BasicWindow destination format." << std::endl;
+            exit(1);
+        }
+    }
+
+public:
+    BasicWindow(const unsigned int width, const unsigned int height, const char* const title = nullptr)
+        : Window(width, height, title) {
+        checkVisual();
+    }
+
+    BasicWindow(const unsigned int width, const unsigned int height, const char* const title,
+                const WindowOptions& options)
+        : Window(width, height, title, options) {
+        checkVisual();
+    }
+
+    // data is width x height pixels in SrcFormat.
+    void render(const uint8_t* data, const int width, const int height) {
+        const Hud::Clock::time_point start = mHud.enabled() ? Hud::Clock::now() : Hud::Clock::time_point{};
+        if (mColorKernel) {
+            mColorKernel->convertImage<SrcFormat>(data, width, height, framebuffer());
+        } else {
+            convertImage<SrcFormat, DstFormat>(data, width, height, framebuffer());
+        }
+        if (start != Hud::Clock::time_point{}) {
+            mHud.conversion(Hud::Clock::now() - start);
+        }
+    }
+
+    // Rows [y, y + rows) in SrcFormat, stride bytes apart, see Window::renderRows().
+    void renderRows(const uint8_t* data, const size_t stride, const int width, const int y, const int rows,
+                    const Store store = Store::Auto) {
+        if (mColorKernel) {
+            mColorKernel->convertRows<SrcFormat>(data, stride, width, y, rows, framebuffer());
+        } else {
+            convertRows<SrcFormat, DstFormat>(data, stride, width, y, rows, framebuffer(), store);
+        }
+    }
+};
+
+}  // namespace cfw
+
 #endif
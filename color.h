@@ -0,0 +1,152 @@
+#ifndef CFW_COLOR_H
+#define CFW_COLOR_H
+
+#include "formats.h"
+#include "framebuffer.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace cfw {
+
+// Per-pixel color correction applied inside render(): a per-channel 8 bit input LUT followed
+// by an optional 3x3 matrix, out = M * lut(in). Matrix coefficients must lie within [-4, 4].
+class ColorTransform {
+    std::array<std::array<uint8_t, 256>, 3> mLut{};
+    std::array<float, 9> mMatrix{1, 0, 0, 0, 1, 0, 0, 0, 1};
+    bool mHasMatrix{false};
+
+public:
+    ColorTransform() {
+        for (auto& lut : mLut) {
+            for (int i = 0; i < 256; ++i) {
+                lut[i] = static_cast<uint8_t>(i);
+            }
+        }
+    }
+
+    // out = 255 * (in / 255) ^ (1 / gamma) on all channels.
+    static ColorTransform gamma(const double gamma) {
+        ColorTransform t;
+        for (int i = 0; i < 256; ++i) {
+            const auto v = static_cast<uint8_t>(std::lround(255.0 * std::pow(i / 255.0, 1.0 / gamma)));
+            t.mLut[0][i] = t.mLut[1][i] = t.mLut[2][i] = v;
+        }
+        return t;
+    }
+
+    // out = (in - 128) * contrast + 128 + brightness on all channels.
+    static ColorTransform contrast(const double contrast, const double brightness = 0) {
+        ColorTransform t;
+        for (int i = 0; i < 256; ++i) {
+            const long v = std::lround((i - 128) * contrast + 128 + brightness);
+            t.mLut[0][i] = t.mLut[1][i] = t.mLut[2][i] = static_cast<uint8_t>(std::min(255L, std::max(0L, v)));
+        }
+        return t;
+    }
+
+    // channel 0 is red, 1 green, 2 blue. With a Gray8 source the three tables map one
+    // intensity to a color, i.e. a false-color palette.
+    void setLut(const int channel, const uint8_t* table) { std::copy(table, table + 256, mLut[channel].begin()); }
+
+    // Row-major, out_r = m[0] * r + m[1] * g + m[2] * b and so on.
+    void setMatrix(const float* m) {
+        std::copy(m, m + 9, mMatrix.begin());
+        mHasMatrix = mMatrix != std::array<float, 9>{1, 0, 0, 0, 1, 0, 0, 0, 1};
+    }
+
+    const std::array<uint8_t, 256>& lut(const int channel) const { return mLut[channel]; }
+    const std::array<float, 9>& matrix() const { return mMatrix; }
+    bool hasMatrix() const { return mHasMatrix; }
+};
+
+// A ColorTransform prepared for one visual. Without a matrix each channel is a single lookup
+// of a pre-shifted word, which costs about the same as the plain conversion. With a matrix the
+// three products of each input channel are packed into one 64 bit table entry, so a pixel is
+// three lookups, two adds and a clamp per output channel.
+class ColorKernel {
+    // Matrix path: three biased 21 bit fixed point fields (8 fractional bits) per entry.
+    static constexpr unsigned int kFieldBits = 21;
+    static constexpr uint64_t kFieldMask = (uint64_t{1} << kFieldBits) - 1;
+    static constexpr int64_t kBias = int64_t{1} << 18;
+
+    std::array<uint32_t, 256> mR{};
+    std::array<uint32_t, 256> mG{};
+    std::array<uint32_t, 256> mB{};
+    std::array<uint64_t, 256> mMatR{};
+    std::array<uint64_t, 256> mMatG{};
+    std::array<uint64_t, 256> mMatB{};
+    unsigned int mShift[3]{};
+    bool mHasMatrix{false};
+
+    static uint64_t packColumn(const float* m, const int column, const int value) {
+        uint64_t packed = 0;
+        for (int row = 0; row < 3; ++row) {
+            const float coefficient = std::min(4.0f, std::max(-4.0f, m[row * 3 + column]));
+            // Rounding for the final >> 8 is folded into the first column.
+            const int64_t term = std::lround(coefficient * value * 256.0f) + kBias + (column == 0 ? 128 : 0);
+            packed |= static_cast<uint64_t>(term) << (kFieldBits * row);
+        }
+        return packed;
+    }
+
+    static uint32_t clampField(const uint64_t sum, const unsigned int row) {
+        const int64_t v = (static_cast<int64_t>((sum >> (kFieldBits * row)) & kFieldMask) - 3 * kBias) >> 8;
+        return static_cast<uint32_t>(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+
+public:
+    ColorKernel(const ColorTransform& transform, const VisualFormat& visual) : mHasMatrix(transform.hasMatrix()) {
+        channelShifts(visual, mShift[0], mShift[1], mShift[2]);
+        for (int i = 0; i < 256; ++i) {
+            const uint8_t r = transform.lut(0)[i];
+            const uint8_t g = transform.lut(1)[i];
+            const uint8_t b = transform.lut(2)[i];
+            mR[i] = static_cast<uint32_t>(r) << mShift[0];
+            mG[i] = static_cast<uint32_t>(g) << mShift[1];
+            mB[i] = static_cast<uint32_t>(b) << mShift[2];
+            mMatR[i] = packColumn(transform.matrix().data(), 0, r);
+            mMatG[i] = packColumn(transform.matrix().data(), 1, g);
+            mMatB[i] = packColumn(transform.matrix().data(), 2, b);
+        }
+    }
+
+    template <class Src>
+    void convertRow(const uint8_t* src, uint32_t* dst, int count) const {
+        if (!mHasMatrix) {
+            for (; count > 0; --count) {
+                *dst++ = mR[src[Src::kR]] | mG[src[Src::kG]] | mB[src[Src::kB]];
+                src += Src::kBytesPerPixel;
+            }
+            return;
+        }
+        for (; count > 0; --count) {
+            const uint64_t sum = mMatR[src[Src::kR]] + mMatG[src[Src::kG]] + mMatB[src[Src::kB]];
+            *dst++ = clampField(sum, 0) << mShift[0] | clampField(sum, 1) << mShift[1] | clampField(sum, 2) << mShift[2];
+            src += Src::kBytesPerPixel;
+        }
+    }
+
+    template <class Src>
+    void convertRows(const uint8_t* src, const size_t stride, const int width, const int y, int rows,
+                     const Framebuffer& fb) const {
+        rows = std::min(rows, fb.height - y);
+        const int cols = std::min(width, fb.width);
+        if (y < 0) {
+            return;
+        }
+        for (int i = 0; i < rows; ++i) {
+            convertRow<Src>(src + i * stride, fb.row(y + i), cols);
+        }
+    }
+
+    template <class Src>
+    void convertImage(const uint8_t* src, const int width, const int height, const Framebuffer& fb) const {
+        convertRows<Src>(src, static_cast<size_t>(width) * Src::kBytesPerPixel, width, 0, height, fb);
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_COLOR_H
@@ -0,0 +1,286 @@
+#ifndef CFW_COMPOSITOR_H
+#define CFW_COMPOSITOR_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace cfw {
+
+namespace blend {
+
+inline uint32_t div255(const uint32_t x) {
+    const uint32_t t = x + 128U;
+    return (t + (t >> 8U)) >> 8U;
+}
+
+// Scale all four channels of a premultiplied pixel by opacity / 255.
+inline uint32_t scale(const uint32_t pixel, const uint32_t opacity) {
+    return div255(((pixel >> 24U) & 0xffU) * opacity) << 24U | div255(((pixel >> 16U) & 0xffU) * opacity) << 16U |
+           div255(((pixel >> 8U) & 0xffU) * opacity) << 8U | div255((pixel & 0xffU) * opacity);
+}
+
+// dst = src + dst * (1 - src.a), with src premultiplied 0xAARRGGBB. Channels saturate like the
+// SIMD paths, so pixels that are not premultiplied give the same result on every CPU.
+inline uint32_t over(const uint32_t src, const uint32_t dst) {
+    const uint32_t inv = 255U - (src >> 24U);
+    uint32_t out = 0;
+    for (uint32_t shift = 0; shift < 32U; shift += 8U) {
+        const uint32_t channel = ((src >> shift) & 0xffU) + div255(((dst >> shift) & 0xffU) * inv);
+        out |= std::min(channel, 255U) << shift;
+    }
+    return out;
+}
+
+#if defined(__AVX2__)
+
+inline __m256i div255(const __m256i x) {
+    const __m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+inline __m256i overHalf(__m256i src, const __m256i dst, const __m256i opacity) {
+    src = div255(_mm256_mullo_epi16(src, opacity));
+    const __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xff), 0xff);
+    const __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    return _mm256_add_epi16(src, div255(_mm256_mullo_epi16(dst, inv)));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+inline __m128i div255(const __m128i x) {
+    const __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+inline __m128i overHalf(__m128i src, const __m128i dst, const __m128i opacity) {
+    src = div255(_mm_mullo_epi16(src, opacity));
+    const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+    const __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return _mm_add_epi16(src, div255(_mm_mullo_epi16(dst, inv)));
+}
+
+#endif
+
+// Blend a run of premultiplied pixels over dst with a global opacity. dst is XRGB: its X byte is
+// written as 0, like every other writer of a window's image.
+inline void overRow(uint32_t* dst, const uint32_t* src, int count, const uint8_t opacity) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    const __m256i op = _mm256_set1_epi16(opacity);
+    for (; count >= 8; count -= 8, src += 8, dst += 8) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst));
+        const __m256i lo = overHalf(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), op);
+        const __m256i hi = overHalf(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), op);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgb));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    const __m128i op = _mm_set1_epi16(opacity);
+    for (; count >= 4; count -= 4, src += 4, dst += 4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+        const __m128i lo = overHalf(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), op);
+        const __m128i hi = overHalf(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), op);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_and_si128(_mm_packus_epi16(lo, hi), rgb));
+    }
+#endif
+    if (opacity == 255) {
+        for (; count > 0; --count) {
+            *dst = over(*src++, *dst) & 0x00ffffffU;
+            ++dst;
+        }
+    } else {
+        for (; count > 0; --count) {
+            *dst = over(scale(*src++, opacity), *dst) & 0x00ffffffU;
+            ++dst;
+        }
+    }
+}
+
+// Copy a run of opaque pixels, dropping their alpha into dst's X byte as 0.
+inline void copyRow(uint32_t* dst, const uint32_t* src, const int count) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = src[i] & 0x00ffffffU;
+    }
+}
+
+}  // namespace blend
+
+// Convert straight-alpha 0xAARRGGBB pixels to the premultiplied form expected by Sprite.
+inline void premultiply(uint32_t* pixels, const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t a = pixels[i] >> 24U;
+        pixels[i] = (blend::scale(pixels[i] | 0xff000000U, a) & 0x00ffffffU) | (a << 24U);
+    }
+}
+
+// Premultiplied 0xAARRGGBB image, pre-split into per-row runs so that blitting
+// skips fully transparent pixels and copies fully opaque ones.
+class Sprite {
+public:
+    enum class RunType : uint8_t { Opaque, Blend };
+
+    struct Run {
+        uint16_t x;
+        uint16_t length;
+        RunType type;
+    };
+
+private:
+    // Opaque runs shorter than this are blended instead, to keep rows from fragmenting.
+    static constexpr int kMinOpaqueRun = 8;
+
+    std::vector<uint32_t> mPixels;
+    std::vector<Run> mRuns;
+    std::vector<uint32_t> mRowStart;  // mRuns index of each row, plus one end entry
+    int mWidth{0};
+    int mHeight{0};
+
+    void buildRuns() {
+        mRowStart.reserve(mHeight + 1);
+        for (int y = 0; y < mHeight; ++y) {
+            mRowStart.push_back(static_cast<uint32_t>(mRuns.size()));
+            const uint32_t* const row = mPixels.data() + static_cast<size_t>(y) * mWidth;
+            int x = 0;
+            while (x < mWidth) {
+                const uint32_t a = row[x] >> 24U;
+                int end = x + 1;
+                if (a == 0) {
+                    while (end < mWidth && (row[end] >> 24U) == 0) {
+                        ++end;
+                    }
+                    x = end;
+                    continue;
+                }
+                RunType type = RunType::Blend;
+                if (a == 255) {
+                    while (end < mWidth && (row[end] >> 24U) == 255) {
+                        ++end;
+                    }
+                    if (end - x >= kMinOpaqueRun) {
+                        type = RunType::Opaque;
+                    }
+                } else {
+                    while (end < mWidth && (row[end] >> 24U) != 0 && (row[end] >> 24U) != 255) {
+                        ++end;
+                    }
+                }
+                if (!mRuns.empty() && mRowStart.back() < mRuns.size() && mRuns.back().type == type &&
+                    type == RunType::Blend && mRuns.back().x + mRuns.back().length == x) {
+                    mRuns.back().length += static_cast<uint16_t>(end - x);
+                } else {
+                    mRuns.push_back({static_cast<uint16_t>(x), static_cast<uint16_t>(end - x), type});
+                }
+                x = end;
+            }
+        }
+        mRowStart.push_back(static_cast<uint32_t>(mRuns.size()));
+    }
+
+public:
+    Sprite() = default;
+
+    // stride is in pixels, 0 means tightly packed.
+    Sprite(const uint32_t* pixels, const int width, const int height, const int stride = 0)
+        : mWidth(width), mHeight(height) {
+        assert(width >= 0 && width <= 0xffff && height >= 0);
+        const int srcStride = stride != 0 ? stride : width;
+        mPixels.resize(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; ++y) {
+            std::memcpy(mPixels.data() + static_cast<size_t>(y) * width, pixels + static_cast<size_t>(y) * srcStride,
+                        width * sizeof(uint32_t));
+        }
+        buildRuns();
+    }
+
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    const uint32_t* row(const int y) const { return mPixels.data() + static_cast<size_t>(y) * mWidth; }
+    const Run* runsBegin(const int y) const { return mRuns.data() + mRowStart[y]; }
+    const Run* runsEnd(const int y) const { return mRuns.data() + mRowStart[y + 1]; }
+};
+
+// Blits sprites onto a framebuffer, clipped to the framebuffer and an optional clip rectangle.
+class Compositor {
+    Framebuffer mTarget;
+    Rect mClip;
+
+public:
+    explicit Compositor(const Framebuffer& target) : mTarget(target), mClip(target.bounds()) {}
+
+    void setClip(const Rect& clip) { mClip = clip.intersect(mTarget.bounds()); }
+    void resetClip() { mClip = mTarget.bounds(); }
+
+    // Returns the damaged rectangle, empty if nothing was drawn.
+    Rect blit(const Sprite& sprite, const int x, const int y, const uint8_t opacity = 255) {
+        const Rect area = Rect{x, y, sprite.width(), sprite.height()}.intersect(mClip);
+        if (area.empty() || opacity == 0) {
+            return {};
+        }
+        const int clipX0 = area.x - x;
+        const int clipX1 = clipX0 + area.width;
+        for (int dy = area.y; dy < area.y + area.height; ++dy) {
+            const int sy = dy - y;
+            const uint32_t* const src = sprite.row(sy);
+            uint32_t* const dst = mTarget.row(dy) + area.x;  // sprite column clipX0, x may be negative
+            for (const Sprite::Run* run = sprite.runsBegin(sy); run != sprite.runsEnd(sy); ++run) {
+                const int x0 = std::max<int>(run->x, clipX0);
+                const int x1 = std::min<int>(run->x + run->length, clipX1);
+                if (x0 >= x1) {
+                    continue;
+                }
+                const bool opaque = run->type == Sprite::RunType::Opaque && opacity == 255;
+                if (mTarget.native()) {
+                    blendRun(dst + (x0 - clipX0), src + x0, x1 - x0, opaque, opacity);
+                } else {
+                    blendConverted(dst + (x0 - clipX0), src + x0, x1 - x0, opaque, opacity);
+                }
+            }
+        }
+        return area;
+    }
+
+private:
+    static void blendRun(uint32_t* dst, const uint32_t* src, const int count, const bool opaque,
+                         const uint8_t opacity) {
+        if (opaque) {
+            blend::copyRow(dst, src, count);
+        } else {
+            blend::overRow(dst, src, count, opacity);
+        }
+    }
+
+    // Sprites are 0xAARRGGBB, so other target layouts are blended in native form a chunk at a time.
+    void blendConverted(uint32_t* dst, const uint32_t* src, int count, const bool opaque,
+                        const uint8_t opacity) const {
+        constexpr int kChunk = 64;
+        uint32_t native[kChunk];
+        for (; count > 0; count -= kChunk, dst += kChunk, src += kChunk) {
+            const int n = std::min(count, kChunk);
+            for (int i = 0; i < n; ++i) {
+                native[i] = mTarget.rgb(dst[i]);
+            }
+            blendRun(native, src, n, opaque, opacity);
+            for (int i = 0; i < n; ++i) {
+                dst[i] = mTarget.pixel(native[i]);
+            }
+        }
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_COMPOSITOR_H
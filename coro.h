@@ -0,0 +1,246 @@
+#ifndef CFW_CORO_H
+#define CFW_CORO_H
+
+#include "cfw.h"
+
+// Coroutine frame loop, for C++20 builds on X11. One Scheduler drives any number of windows from
+// the calling thread: it polls the display connection itself (DisplayContext::Dispatch::Manual),
+// so events and present completions are handled where the tasks run, without an event thread,
+// cross-thread callbacks or fixed sleeps.
+//
+//     cfw::Task loop(cfw::Scheduler& scheduler) {
+//         cfw::AsyncWindow window(scheduler, 640, 480, "coro");
+//         for (;;) {
+//             co_await window.nextFrame();
+//             window.render(...);
+//             window.paint();
+//         }
+//     }
+//
+//     cfw::Scheduler scheduler;
+//     scheduler.spawn(loop(scheduler));
+//     scheduler.run();
+
+#if defined(__cpp_impl_coroutine) && OS_TYPE == OS_UNIX
+
+#include <poll.h>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace cfw {
+
+class Scheduler;
+
+// A coroutine run by a Scheduler, started by Scheduler::spawn().
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task(Task&& other) noexcept : mHandle(std::exchange(other.mHandle, {})) {}
+    ~Task() {
+        if (mHandle) {
+            mHandle.destroy();
+        }
+    }
+
+    Task(const Task&) = delete;
+    void operator=(const Task&) = delete;
+    void operator=(Task&&) = delete;
+
+private:
+    friend class Scheduler;
+
+    explicit Task(const std::coroutine_handle<promise_type> handle) : mHandle(handle) {}
+
+    std::coroutine_handle<promise_type> mHandle;
+};
+
+class AsyncWindow;
+
+class Scheduler {
+    friend class AsyncWindow;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct FrameWaiter {
+        const AsyncWindow* window;
+        uint64_t frame;  // resume once this many frames are presented
+        Clock::time_point deadline;
+        std::coroutine_handle<> handle;
+    };
+
+    std::shared_ptr<DisplayContext> mContext;
+    std::vector<std::coroutine_handle<Task::promise_type>> mTasks;
+    std::deque<std::coroutine_handle<>> mReady;
+    std::vector<FrameWaiter> mFrameWaiters;
+    bool mStopped{false};
+
+    inline void releaseFrames(Clock::time_point now);
+
+public:
+    // nextFrame() gives up waiting for a present after this long, e.g. while the window is unmapped.
+    static constexpr std::chrono::milliseconds kFrameTimeout{100};
+
+    Scheduler() : mContext(std::make_shared<DisplayContext>(DisplayContext::Dispatch::Manual)) {}
+
+    ~Scheduler() {
+        for (const auto task : mTasks) {
+            task.destroy();
+        }
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler(Scheduler&&) = delete;
+    void operator=(const Scheduler&) = delete;
+    void operator=(Scheduler&&) = delete;
+
+    const std::shared_ptr<DisplayContext>& context() const { return mContext; }
+
+    // Runs the task from the next run() iteration on. Tasks may spawn more tasks.
+    void spawn(Task task) {
+        const auto handle = std::exchange(task.mHandle, {});
+        mTasks.push_back(handle);
+        mReady.push_back(handle);
+    }
+
+    // Make run() return after the current task suspends. Unfinished tasks are destroyed with the
+    // Scheduler, which also closes the windows they own.
+    void stop() { mStopped = true; }
+
+    // Run until every task has finished or stop() is called.
+    void run() {
+        mStopped = false;
+        while (!mTasks.empty()) {
+            while (!mReady.empty() && !mStopped) {
+                const std::coroutine_handle<> handle = mReady.front();
+                mReady.pop_front();
+                handle.resume();
+            }
+            for (auto it = mTasks.begin(); it != mTasks.end();) {
+                if (it->done()) {
+                    it->destroy();
+                    it = mTasks.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (mTasks.empty() || mStopped) {
+                break;
+            }
+
+            mContext->dispatch();  // may queue tasks waiting for events or presents
+            releaseFrames(Clock::now());
+            if (!mReady.empty()) {
+                continue;
+            }
+
+            // Sleep until the server sends something or the earliest frame deadline.
+            int timeout = -1;
+            for (const FrameWaiter& waiter : mFrameWaiters) {
+                const auto left = std::chrono::ceil<std::chrono::milliseconds>(waiter.deadline - Clock::now()).count();
+                timeout = std::max(0, timeout < 0 ? static_cast<int>(left) : std::min(timeout, static_cast<int>(left)));
+            }
+            pollfd fd{mContext->fd(), POLLIN, 0};
+            if (fd.fd < 0 && timeout < 0) {
+                std::cerr << "cfw::Scheduler: tasks are waiting without any window to wake them." << std::endl;
+                return;
+            }
+            poll(&fd, fd.fd >= 0 ? 1 : 0, timeout);
+        }
+    }
+};
+
+// A window whose frames and events are awaited from tasks of one Scheduler.
+class AsyncWindow : public Window {
+    Scheduler& mScheduler;
+    std::deque<InputEvent> mEvents;
+    std::coroutine_handle<> mEventWaiter;
+
+    static WindowOptions optionsFor(const Scheduler& scheduler) {
+        WindowOptions options;
+        options.async = true;  // keep the other tasks running while this one maps
+        options.context = scheduler.context();
+        return options;
+    }
+
+public:
+    AsyncWindow(Scheduler& scheduler, const unsigned int width, const unsigned int height,
+                const char* const title = nullptr)
+        : Window(width, height, title, optionsFor(scheduler)), mScheduler(scheduler) {
+        setEventCallback([this](const InputEvent& event) {
+            mEvents.push_back(event);
+            if (mEventWaiter) {
+                mScheduler.mReady.push_back(std::exchange(mEventWaiter, {}));
+            }
+        });
+    }
+
+    ~AsyncWindow() { setEventCallback(nullptr); }  // the base destructor still dispatches a close
+
+    // Resumes once every frame painted so far has been presented, so a render loop runs at the
+    // pace the X server takes frames. Resumes right away if nothing is in flight.
+    auto nextFrame() {
+        struct Awaiter {
+            AsyncWindow& window;
+            bool await_ready() const { return window.presentedFrames() >= window.paintedFrames(); }
+            void await_suspend(const std::coroutine_handle<> handle) {
+                window.mScheduler.mFrameWaiters.push_back(
+                        {&window, window.paintedFrames(), Scheduler::Clock::now() + Scheduler::kFrameTimeout, handle});
+            }
+            void await_resume() const {}
+        };
+        return Awaiter{*this};
+    }
+
+    // Resumes with the next key, char, mouse or close event. One task at a time may wait.
+    auto nextEvent() {
+        struct Awaiter {
+            AsyncWindow& window;
+            bool await_ready() const { return !window.mEvents.empty(); }
+            void await_suspend(const std::coroutine_handle<> handle) { window.mEventWaiter = handle; }
+            InputEvent await_resume() {
+                const InputEvent event = window.mEvents.front();
+                window.mEvents.pop_front();
+                return event;
+            }
+        };
+        return Awaiter{*this};
+    }
+
+    // Takes a queued event without waiting, for frame loops that also handle input.
+    bool pollEvent(InputEvent& event) {
+        if (mEvents.empty()) {
+            return false;
+        }
+        event = mEvents.front();
+        mEvents.pop_front();
+        return true;
+    }
+};
+
+inline void Scheduler::releaseFrames(const Clock::time_point now) {
+    for (auto it = mFrameWaiters.begin(); it != mFrameWaiters.end();) {
+        if (it->window->presentedFrames() >= it->frame || now >= it->deadline) {
+            mReady.push_back(it->handle);
+            it = mFrameWaiters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+}  // namespace cfw
+
+#endif
+
+#endif  // CFW_CORO_H
@@ -0,0 +1,67 @@
+#include "coro.h"
+#include <vector>
+
+// Two windows on one thread: a frame loop paced by presents, and a window that only waits for input.
+
+cfw::Task animate(cfw::Scheduler& scheduler) {
+  cfw::AsyncWindow window(scheduler, 640, 480, "Frames");
+  std::vector<unsigned char> img(640 * 480 * 3);
+
+  for (int frame = 0;; ++frame) {
+    co_await window.nextFrame();
+
+    cfw::InputEvent event;
+    while (window.pollEvent(event)) {
+      if (event.type == cfw::InputEvent::Type::Close ||
+          (event.type == cfw::InputEvent::Type::Key && event.key == static_cast<uint8_t>(cfw::Keys::ESC))) {
+        scheduler.stop();
+        co_return;
+      }
+    }
+
+    for (int y = 0; y < 480; ++y) {
+      for (int x = 0; x < 640; ++x) {
+        unsigned char* p = &img[(y * 640 + x) * 3];
+        p[0] = static_cast<unsigned char>(x + frame);
+        p[1] = static_cast<unsigned char>(y + frame);
+        p[2] = static_cast<unsigned char>(frame * 2);
+      }
+    }
+    window.render(img.data(), 640, 480);
+    window.paint();
+  }
+}
+
+cfw::Task input(cfw::Scheduler& scheduler) {
+  cfw::AsyncWindow window(scheduler, 320, 240, "Input");
+
+  for (;;) {
+    const cfw::InputEvent event = co_await window.nextEvent();
+    switch (event.type) {
+      case cfw::InputEvent::Type::Mouse:
+        printf("mouse %d %d 0x%08x, %d\n", event.x, event.y, event.buttons, event.wheel);
+        break;
+      case cfw::InputEvent::Type::Char:
+        printf("char '%s'\n", event.text);
+        break;
+      case cfw::InputEvent::Type::Key:
+        if (event.key == static_cast<uint8_t>(cfw::Keys::Q)) {
+          scheduler.stop();
+          co_return;
+        }
+        break;
+      case cfw::InputEvent::Type::Close:
+        scheduler.stop();
+        co_return;
+    }
+  }
+}
+
+int main(int  /*argc*/,char ** /*argv*/) {
+  cfw::Scheduler scheduler;
+  scheduler.spawn(animate(scheduler));
+  scheduler.spawn(input(scheduler));
+  scheduler.run();
+
+  return 0;
+}
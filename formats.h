@@ -0,0 +1,203 @@
+#ifndef CFW_FORMATS_H
+#define CFW_FORMATS_H
+
+#include "framebuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cfw {
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool kHostBigEndian = true;
+#else
+constexpr bool kHostBigEndian = false;
+#endif
+
+// Layout of the window system's image, as detected at runtime by the backends.
+struct VisualFormat {
+    unsigned int depth{24};
+    bool bigEndian{false};  // byte order of the image, not of the host
+    bool bgr{false};
+};
+
+namespace format {
+
+// Source formats: bytes per pixel and the byte offset of each channel.
+template <int Bpp, int R, int G, int B>
+struct Source {
+    static constexpr bool kIsSource = true;
+    static constexpr int kBytesPerPixel = Bpp;
+    static constexpr int kR = R;
+    static constexpr int kG = G;
+    static constexpr int kB = B;
+};
+
+using RGB24 = Source<3, 0, 1, 2>;
+using BGR24 = Source<3, 2, 1, 0>;
+using RGBX32 = Source<4, 0, 1, 2>;  // RGBA with alpha ignored
+using BGRX32 = Source<4, 2, 1, 0>;
+using Gray8 = Source<1, 0, 0, 0>;
+
+// Destination formats: 32 bit pixels in the image, given by the byte offset of each channel
+// in memory. The shift tables below turn those into word shifts for the host byte order.
+template <int R, int G, int B, bool BigEndian, bool Bgr>
+struct Destination {
+    static constexpr bool kIsDestination = true;
+    static constexpr bool kBigEndian = BigEndian;
+    static constexpr bool kBgr = Bgr;
+
+    static constexpr unsigned int shiftOf(const int byte) { return 8U * (kHostBigEndian ? 3 - byte : byte); }
+    static constexpr unsigned int kShiftR = shiftOf(R);
+    static constexpr unsigned int kShiftG = shiftOf(G);
+    static constexpr unsigned int kShiftB = shiftOf(B);
+
+    static bool matches(const VisualFormat& visual) {
+        return visual.depth == 24 && visual.bigEndian == BigEndian && visual.bgr == Bgr;
+    }
+};
+
+using XRGB32LE = Destination<2, 1, 0, false, false>;  // the common little endian TrueColor visual
+using XRGB32BE = Destination<1, 2, 3, true, false>;
+using XBGR32LE = Destination<0, 1, 2, false, true>;
+using XBGR32BE = Destination<3, 2, 1, true, true>;
+
+// Native XRGB words on this host, the layout Framebuffer documents.
+using Native = std::conditional_t<kHostBigEndian, XRGB32BE, XRGB32LE>;
+
+}  // namespace format
+
+// Word shifts of the R, G and B channels for a runtime visual, host byte order applied.
+inline void channelShifts(const VisualFormat& visual, unsigned int& r, unsigned int& g, unsigned int& b) {
+    if (visual.bgr) {
+        r = visual.bigEndian ? format::XBGR32BE::kShiftR : format::XBGR32LE::kShiftR;
+        g = visual.bigEndian ? format::XBGR32BE::kShiftG : format::XBGR32LE::kShiftG;
+        b = visual.bigEndian ? format::XBGR32BE::kShiftB : format::XBGR32LE::kShiftB;
+    } else {
+        r = visual.bigEndian ? format::XRGB32BE::kShiftR : format::XRGB32LE::kShiftR;
+        g = visual.bigEndian ? format::XRGB32BE::kShiftG : format::XRGB32LE::kShiftG;
+        b = visual.bigEndian ? format::XRGB32BE::kShiftB : format::XRGB32LE::kShiftB;
+    }
+}
+
+template <class Src, class Dst>
+inline uint32_t convertPixel(const uint8_t* src) {
+    return static_cast<uint32_t>(src[Src::kR]) << Dst::kShiftR | static_cast<uint32_t>(src[Src::kG]) << Dst::kShiftG |
+           static_cast<uint32_t>(src[Src::kB]) << Dst::kShiftB;
+}
+
+// Branch-free conversion of one row, all offsets and shifts are compile-time constants.
+template <class Src, class Dst>
+inline void convertRow(const uint8_t* src, uint32_t* dst, int count) {
+    static_assert(Src::kIsSource, "Src must be a cfw::format source format");
+    static_assert(Dst::kIsDestination, "Dst must be a cfw::format destination format");
+    for (; count > 0; --count) {
+        *dst++ = convertPixel<Src, Dst>(src);
+        src += Src::kBytesPerPixel;
+    }
+}
+
+// How convertImage() writes the framebuffer. Non-temporal stores bypass the cache, so a frame
+// much larger than the cache does not evict the application's working set on its way to the
+// X server, which reads it from memory anyway.
+enum class Store {
+    Auto,       // streaming from kStreamingStoreBytes on
+    Cached,
+    Streaming,  // needs SSE2, cached elsewhere
+};
+
+// A frame this large does not fit a typical L2 (720p XRGB is 3.5 MiB, 1080p 7.9 MiB), so cached
+// stores only evict; streaming also measured faster from 540p up.
+constexpr size_t kStreamingStoreBytes = size_t{2} << 20U;
+
+// As convertRow(), four pixels at a time with non-temporal stores. Callers fence, see convertImage().
+template <class Src, class Dst>
+inline void convertRowStreaming(const uint8_t* src, uint32_t* dst, int count) {
+#if defined(__SSE2__)
+    for (; count > 0 && (reinterpret_cast<uintptr_t>(dst) & 15U) != 0; --count) {
+        *dst++ = convertPixel<Src, Dst>(src);
+        src += Src::kBytesPerPixel;
+    }
+    for (; count >= 4; count -= 4) {
+        const __m128i pixels = _mm_setr_epi32(static_cast<int>(convertPixel<Src, Dst>(src)),
+                                              static_cast<int>(convertPixel<Src, Dst>(src + Src::kBytesPerPixel)),
+                                              static_cast<int>(convertPixel<Src, Dst>(src + 2 * Src::kBytesPerPixel)),
+                                              static_cast<int>(convertPixel<Src, Dst>(src + 3 * Src::kBytesPerPixel)));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), pixels);
+        src += 4 * Src::kBytesPerPixel;
+        dst += 4;
+    }
+#endif
+    convertRow<Src, Dst>(src, dst, count);
+}
+
+// Convert rows [y, y + rows) of a width wide image into the same rows of the framebuffer, clipped
+// to it. src points at row y and rows are stride bytes apart, so a decoder can hand over a strip at
+// a time. Store::Auto decides on the strip, pass the store picked for the whole image instead.
+template <class Src, class Dst>
+inline void convertRows(const uint8_t* src, const size_t stride, const int width, const int y, int rows,
+                        const Framebuffer& fb, const Store store = Store::Auto) {
+    rows = std::min(rows, fb.height - y);
+    const int cols = std::min(width, fb.width);
+    if (y < 0 || rows <= 0 || cols <= 0) {
+        return;
+    }
+    const bool streaming = store == Store::Streaming ||
+                           (store == Store::Auto && static_cast<size_t>(rows) * cols * 4 >= kStreamingStoreBytes);
+    void (*const row)(const uint8_t*, uint32_t*, int) =
+            streaming ? convertRowStreaming<Src, Dst> : convertRow<Src, Dst>;
+    if (cols == fb.stride && cols == width && stride == static_cast<size_t>(width) * Src::kBytesPerPixel) {
+        row(src, fb.row(y), cols * rows);
+    } else {
+        for (int i = 0; i < rows; ++i) {
+            row(src + i * stride, fb.row(y + i), cols);
+        }
+    }
+#if defined(__SSE2__)
+    if (streaming) {
+        _mm_sfence();  // order the streamed pixels before the put that presents them
+    }
+#endif
+}
+
+// Convert a width x height image into the framebuffer, clipped to both.
+template <class Src, class Dst>
+inline void convertImage(const uint8_t* src, const int width, const int height, const Framebuffer& fb,
+                         const Store store = Store::Auto) {
+    convertRows<Src, Dst>(src, static_cast<size_t>(width) * Src::kBytesPerPixel, width, 0, height, fb, store);
+}
+
+// Runtime selection of the destination, for windows that detect the visual. One branch per strip.
+template <class Src>
+inline void convertRows(const uint8_t* src, const size_t stride, const int width, const int y, const int rows,
+                        const Framebuffer& fb, const VisualFormat& visual, const Store store = Store::Auto) {
+    if (visual.bgr) {
+        if (visual.bigEndian) {
+            convertRows<Src, format::XBGR32BE>(src, stride, width, y, rows, fb, store);
+        } else {
+            convertRows<Src, format::XBGR32LE>(src, stride, width, y, rows, fb, store);
+        }
+    } else {
+        if (visual.bigEndian) {
+            convertRows<Src, format::XRGB32BE>(src, stride, width, y, rows, fb, store);
+        } else {
+            convertRows<Src, format::XRGB32LE>(src, stride, width, y, rows, fb, store);
+        }
+    }
+}
+
+// As above for a whole image. One branch per frame.
+template <class Src>
+inline void convertImage(const uint8_t* src, const int width, const int height, const Framebuffer& fb,
+                         const VisualFormat& visual, const Store store = Store::Auto) {
+    convertRows<Src>(src, static_cast<size_t>(width) * Src::kBytesPerPixel, width, 0, height, fb, visual, store);
+}
+
+}  // namespace cfw
+
+#endif  // CFW_FORMATS_H
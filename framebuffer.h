@@ -0,0 +1,72 @@
+#ifndef CFW_FRAMEBUFFER_H
+#define CFW_FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace cfw {
+
+struct Rect {
+    int x{0};
+    int y{0};
+    int width{0};
+    int height{0};
+
+    bool empty() const { return width <= 0 || height <= 0; }
+
+    Rect intersect(const Rect& other) const {
+        const int x0 = std::max(x, other.x);
+        const int y0 = std::max(y, other.y);
+        const int x1 = std::min(x + width, other.x + other.width);
+        const int y1 = std::min(y + height, other.y + other.height);
+        return {x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0)};
+    }
+
+    Rect unite(const Rect& other) const {
+        if (empty()) {
+            return other;
+        }
+        if (other.empty()) {
+            return *this;
+        }
+        const int x0 = std::min(x, other.x);
+        const int y0 = std::min(y, other.y);
+        const int x1 = std::max(x + width, other.x + other.width);
+        const int y1 = std::max(y + height, other.y + other.height);
+        return {x0, y0, x1 - x0, y1 - y0};
+    }
+};
+
+// View of a window's backing store, stride is in pixels. Pixels are 32 bit words in the window
+// system's layout: R, G and B at the word shifts below, the remaining byte unused. That is native
+// 0x00RRGGBB unless the X server has a BGR or opposite-endian visual, so code that writes colors
+// converts them with pixel() and reads pixels back with rgb().
+struct Framebuffer {
+    uint32_t* pixels{nullptr};
+    int width{0};
+    int height{0};
+    int stride{0};
+    unsigned int shiftR{16};
+    unsigned int shiftG{8};
+    unsigned int shiftB{0};
+
+    uint32_t* row(const int y) const { return pixels + static_cast<ptrdiff_t>(y) * stride; }
+    Rect bounds() const { return {0, 0, width, height}; }
+
+    bool native() const { return shiftR == 16 && shiftG == 8 && shiftB == 0; }
+
+    // Native 0x00RRGGBB color to a pixel of this layout.
+    uint32_t pixel(const uint32_t rgb) const {
+        return (rgb >> 16U & 0xffU) << shiftR | (rgb >> 8U & 0xffU) << shiftG | (rgb & 0xffU) << shiftB;
+    }
+
+    // Pixel of this layout to native 0x00RRGGBB.
+    uint32_t rgb(const uint32_t pixel) const {
+        return (pixel >> shiftR & 0xffU) << 16U | (pixel >> shiftG & 0xffU) << 8U | (pixel >> shiftB & 0xffU);
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_FRAMEBUFFER_H
@@ -0,0 +1,221 @@
+#ifndef CFW_HUD_H
+#define CFW_HUD_H
+
+#include "framebuffer.h"
+#include "text.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace cfw {
+
+// Performance overlay. The window feeds it timings from its render, present and event
+// paths and draws it into the backing store right before presenting. Recording is a
+// no-op while the overlay is disabled. The pixels under the overlay are kept, so the
+// first paint after disabling puts the application's image back.
+class Hud {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    static constexpr int kHistory = 128;
+    static constexpr int kGraphHeight = 40;
+    static constexpr int kMargin = 8;
+    static constexpr uint32_t kBackground = 0x202020;
+    static constexpr uint32_t kForeground = 0xe0e0e0;
+
+    std::atomic<bool> mEnabled{false};
+    std::atomic<bool> mShown{false};  // enabled, or drawn and not yet removed
+    std::mutex mMutex;
+    TextRenderer mText;
+
+    Rect mArea;                    // last drawn, empty if nothing to remove
+    std::vector<uint32_t> mUnder;  // the application's pixels under mArea
+    std::vector<uint32_t> mDrawn;  // the overlay as drawn, to tell which pixels were redrawn since
+
+    std::array<float, kHistory> mFrameMs{};
+    int mHead{0};
+    Clock::time_point mLastFrame{};
+    double mFrameAvgMs{0};
+    double mConversionMs{0};
+    double mPresentMs{0};
+    uint64_t mRateEvents{0};
+    Clock::time_point mRateStart{};
+    double mEventRate{0};
+
+    static double ms(const Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+    // Exponential moving average, so the counters stay readable at high frame rates.
+    static void smooth(double& value, const double sample) { value = value == 0 ? sample : value * 0.9 + sample * 0.1; }
+
+    // Put back the application's pixels where the overlay is still intact, returns the old area.
+    Rect restoreLocked(const Framebuffer& fb) {
+        const Rect area = mArea.intersect(fb.bounds());
+        for (int y = area.y; y < area.y + area.height; ++y) {
+            uint32_t* const row = fb.row(y) + mArea.x;
+            const size_t at = static_cast<size_t>(y - mArea.y) * mArea.width;
+            for (int x = area.x - mArea.x; x < area.x + area.width - mArea.x; ++x) {
+                if (row[x] == mDrawn[at + x]) {
+                    row[x] = mUnder[at + x];
+                }
+            }
+        }
+        const Rect restored = mArea;
+        mArea = {};
+        mShown = mEnabled.load();
+        return restored;
+    }
+
+    void copyArea(const Framebuffer& fb, std::vector<uint32_t>& to) const {
+        to.resize(static_cast<size_t>(mArea.width) * mArea.height);
+        for (int y = 0; y < mArea.height; ++y) {
+            std::copy_n(fb.row(mArea.y + y) + mArea.x, mArea.width, to.data() + static_cast<size_t>(y) * mArea.width);
+        }
+    }
+
+public:
+    Hud() {
+        const char* const env = std::getenv("CFW_HUD");
+        if (env != nullptr && env[0] != '\0' && env[0] != '0') {
+            mEnabled = true;
+            mShown = true;
+        }
+    }
+
+    bool enabled() const { return mEnabled; }
+
+    // The window calls draw() on paint while this is set, also to remove a disabled overlay.
+    bool shown() const { return mShown; }
+
+    void setEnabled(const bool enabled) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEnabled = enabled;
+        mShown = enabled || !mArea.empty();
+        mFrameMs.fill(0);
+        mLastFrame = {};
+        mFrameAvgMs = mConversionMs = mPresentMs = mEventRate = 0;
+        mRateStart = {};
+        mRateEvents = 0;
+    }
+
+    void toggle() { setEnabled(!mEnabled); }
+
+    // Called once per presented frame.
+    void frame() {
+        if (!mEnabled) {
+            return;
+        }
+        const Clock::time_point now = Clock::now();
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mLastFrame != Clock::time_point{}) {
+            mFrameMs[mHead] = static_cast<float>(ms(now - mLastFrame));
+            smooth(mFrameAvgMs, mFrameMs[mHead]);
+            mHead = (mHead + 1) % kHistory;
+        }
+        mLastFrame = now;
+
+        if (mRateStart == Clock::time_point{}) {
+            mRateStart = now;
+        } else if (now - mRateStart >= std::chrono::seconds(1)) {
+            mEventRate = static_cast<double>(mRateEvents) * 1000.0 / ms(now - mRateStart);
+            mRateEvents = 0;
+            mRateStart = now;
+        }
+    }
+
+    void conversion(const Clock::duration d) {
+        if (mEnabled) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            smooth(mConversionMs, ms(d));
+        }
+    }
+
+    void present(const Clock::duration d) {
+        if (mEnabled) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            smooth(mPresentMs, ms(d));
+        }
+    }
+
+    void event() {
+        if (mEnabled) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            ++mRateEvents;
+        }
+    }
+
+    // Draw the overlay in the top left corner, or remove it once disabled. Returns the damaged area.
+    Rect draw(const Framebuffer& fb) {
+        if (!mShown || fb.pixels == nullptr) {
+            return {};
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mEnabled) {
+            return restoreLocked(fb);
+        }
+
+        char text[160];
+        std::snprintf(text, sizeof(text),
+                      "FPS     %6.1f\nframe   %6.2f ms\nconvert %6.2f ms\npresent %6.2f ms\nevents  %6.0f/s",
+                      mFrameAvgMs > 0 ? 1000.0 / mFrameAvgMs : 0.0, mFrameAvgMs, mConversionMs, mPresentMs,
+                      mEventRate);
+        const Rect box = mText.measure(text);
+        const Rect textArea = Rect{kMargin, kMargin, box.width, box.height}.intersect(fb.bounds());
+        // Frame time graph, full height is two frames at 60 Hz.
+        const Rect graph = Rect{kMargin, textArea.y + textArea.height, kHistory, kGraphHeight}.intersect(fb.bounds());
+
+        // Keep what the application drew under the overlay since the last frame.
+        const Rect area = textArea.unite(graph);
+        Rect damage = area;
+        if (area.x != mArea.x || area.y != mArea.y || area.width != mArea.width || area.height != mArea.height) {
+            damage = damage.unite(restoreLocked(fb));
+            mArea = area;
+            copyArea(fb, mUnder);
+        } else {
+            for (int y = 0; y < area.height; ++y) {
+                const uint32_t* const row = fb.row(area.y + y) + area.x;
+                const size_t at = static_cast<size_t>(y) * area.width;
+                for (int x = 0; x < area.width; ++x) {
+                    if (row[x] != mDrawn[at + x]) {
+                        mUnder[at + x] = row[x];
+                    }
+                }
+            }
+        }
+        mShown = true;
+
+        mText.draw(fb, kMargin, kMargin, text, kForeground, kBackground);
+        for (int y = graph.y; y < graph.y + graph.height; ++y) {
+            std::fill_n(fb.row(y) + graph.x, graph.width, fb.pixel(kBackground));
+        }
+        const int graphBottom = kMargin + textArea.height + kGraphHeight;
+        const int budget = graphBottom - kGraphHeight / 2;
+        if (budget >= graph.y && budget < graph.y + graph.height) {
+            std::fill_n(fb.row(budget) + graph.x, graph.width, fb.pixel(0x606060));
+        }
+        for (int i = 0; i < kHistory; ++i) {
+            const int x = kMargin + i;
+            if (x < graph.x || x >= graph.x + graph.width) {
+                continue;
+            }
+            const float sample = mFrameMs[(mHead + i) % kHistory];
+            const int bar = std::min(kGraphHeight, static_cast<int>(sample * kGraphHeight / 33.3f + 0.5f));
+            const uint32_t color = fb.pixel(sample <= 17.0f ? 0x40c040 : sample <= 34.0f ? 0xd0c040 : 0xd04040);
+            for (int y = std::max(graph.y, graphBottom - bar); y < std::min(graph.y + graph.height, graphBottom); ++y) {
+                fb.row(y)[x] = color;
+            }
+        }
+        mText.takeDamage();
+        copyArea(fb, mDrawn);
+        return damage;
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_HUD_H
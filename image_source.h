@@ -0,0 +1,469 @@
+#ifndef CFW_IMAGE_SOURCE_H
+#define CFW_IMAGE_SOURCE_H
+
+#include "cfw.h"
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+#if OS_TYPE == OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Images and frame sequences rendered from disk without reading them into memory first: the file
+// is mapped and its rows are converted straight into the window's image with renderRows().
+
+namespace cfw {
+
+// Read-only mapping of a whole file. Pages are read from disk on first touch.
+class MappedFile {
+    const uint8_t* mData{nullptr};
+    size_t mSize{0};
+#if OS_TYPE == OS_WINDOWS
+    HANDLE mMapping{nullptr};
+#endif
+
+#if OS_TYPE == OS_UNIX
+    void advise(const size_t offset, size_t size, const int advice) const {
+        if (mData == nullptr || offset >= mSize) {
+            return;
+        }
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t start = offset / page * page;
+        size = std::min(size, mSize - offset) + (offset - start);
+        madvise(const_cast<uint8_t*>(mData) + start, size, advice);
+    }
+#endif
+
+public:
+    explicit MappedFile(const std::string& path) {
+#if OS_TYPE == OS_UNIX
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st {};
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            std::cerr << "Failed to open " << path << "." << std::endl;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        void* const data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);  // the mapping keeps the file
+        if (data == MAP_FAILED) {
+            std::cerr << "Failed to map " << path << "." << std::endl;
+            return;
+        }
+        mData = static_cast<const uint8_t*>(data);
+        mSize = static_cast<size_t>(st.st_size);
+        // Read in order: larger readahead, and pages behind the reader are reclaimed first.
+        madvise(data, mSize, MADV_SEQUENTIAL);
+#elif OS_TYPE == OS_WINDOWS
+        const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER size{};
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            std::cerr << "Failed to open " << path << "." << std::endl;
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+            }
+            return;
+        }
+        mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mMapping != nullptr) {
+            mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (mData == nullptr) {
+            std::cerr << "Failed to map " << path << "." << std::endl;
+            return;
+        }
+        mSize = static_cast<size_t>(size.QuadPart);
+#endif
+    }
+
+    ~MappedFile() {
+#if OS_TYPE == OS_UNIX
+        if (mData != nullptr) {
+            munmap(const_cast<uint8_t*>(mData), mSize);
+        }
+#elif OS_TYPE == OS_WINDOWS
+        if (mData != nullptr) {
+            UnmapViewOfFile(mData);
+        }
+        if (mMapping != nullptr) {
+            CloseHandle(mMapping);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+
+    bool ok() const { return mData != nullptr; }
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+    // Start reading a range in the background, e.g. the frame after the one being shown.
+    void prefetch(const size_t offset, const size_t size) const {
+#if OS_TYPE == OS_UNIX
+        advise(offset, size, MADV_WILLNEED);
+#endif
+    }
+
+    // Drop a consumed range from this mapping so long sequences do not pile up resident pages.
+    // The data stays in the page cache and is read again on the next touch.
+    void release(const size_t offset, const size_t size) const {
+#if OS_TYPE == OS_UNIX
+        advise(offset, size, MADV_DONTNEED);
+#endif
+    }
+};
+
+// Pixel layout of an image in a file, see renderRows() below.
+enum class PixelLayout {
+    Gray8,
+    RGB24,
+    BGR24,
+    RGBX32,  // RGBA with alpha ignored
+    BGRX32,
+};
+
+inline int bytesPerPixel(const PixelLayout layout) {
+    switch (layout) {
+        case PixelLayout::Gray8:
+            return 1;
+        case PixelLayout::RGB24:
+        case PixelLayout::BGR24:
+            return 3;
+        case PixelLayout::RGBX32:
+        case PixelLayout::BGRX32:
+            return 4;
+    }
+    return 0;
+}
+
+// Window::renderRows() with the source format picked at runtime, one branch per strip.
+template <class Win>
+inline void renderRows(Win& window, const PixelLayout layout, const uint8_t* data, const size_t stride,
+                       const int width, const int y, const int rows, const Store store = Store::Auto) {
+    switch (layout) {
+        case PixelLayout::Gray8:
+            window.template renderRows<format::Gray8>(data, stride, width, y, rows, store);
+            break;
+        case PixelLayout::RGB24:
+            window.template renderRows<format::RGB24>(data, stride, width, y, rows, store);
+            break;
+        case PixelLayout::BGR24:
+            window.template renderRows<format::BGR24>(data, stride, width, y, rows, store);
+            break;
+        case PixelLayout::RGBX32:
+            window.template renderRows<format::RGBX32>(data, stride, width, y, rows, store);
+            break;
+        case PixelLayout::BGRX32:
+            window.template renderRows<format::BGRX32>(data, stride, width, y, rows, store);
+            break;
+    }
+}
+
+// A still image or a sequence of equally sized frames rendered directly from a mapped file:
+// binary PGM/PPM (P5/P6) and PAM (P7) with 8 bit samples, several images concatenated making a
+// sequence, or headerless frame dumps. Frames are converted from the page cache into the window
+// in one pass, and the next frame is read ahead while the current one is shown.
+class ImageFile {
+    MappedFile mFile;
+    int mWidth{0};
+    int mHeight{0};
+    PixelLayout mLayout{PixelLayout::RGB24};
+    size_t mFrameBytes{0};
+    std::vector<size_t> mFrames;  // offset of each frame's pixels
+
+    // Parses the Netpbm header at pos, returns the offset of the pixels or 0.
+    size_t parseHeader(size_t pos, int& width, int& height, PixelLayout& layout) const {
+        const uint8_t* const data = mFile.data();
+        const size_t size = mFile.size();
+        const auto skipSpace = [&]() {
+            while (pos < size && (std::isspace(data[pos]) != 0 || data[pos] == '#')) {
+                if (data[pos] == '#') {
+                    while (pos < size && data[pos] != '\n') {
+                        ++pos;
+                    }
+                } else {
+                    ++pos;
+                }
+            }
+        };
+        const auto number = [&]() {
+            skipSpace();
+            long value = 0;
+            const size_t start = pos;
+            while (pos < size && data[pos] >= '0' && data[pos] <= '9' && value < (1L << 24)) {
+                value = value * 10 + (data[pos++] - '0');
+            }
+            return pos == start ? -1L : value;
+        };
+        const auto token = [&]() {
+            skipSpace();
+            std::string word;
+            while (pos < size && std::isspace(data[pos]) == 0) {
+                word += static_cast<char>(data[pos++]);
+            }
+            return word;
+        };
+
+        if (pos + 3 > size || data[pos] != 'P') {
+            return 0;
+        }
+        const uint8_t type = data[pos + 1];
+        pos += 2;
+        long w = -1, h = -1, depth = -1, maxval = -1;
+        if (type == '5' || type == '6') {
+            w = number();
+            h = number();
+            maxval = number();
+            depth = type == '5' ? 1 : 3;
+        } else if (type == '7') {
+            for (std::string key = token(); key != "ENDHDR"; key = token()) {
+                if (key == "WIDTH") {
+                    w = number();
+                } else if (key == "HEIGHT") {
+                    h = number();
+                } else if (key == "DEPTH") {
+                    depth = number();
+                } else if (key == "MAXVAL") {
+                    maxval = number();
+                } else if (key == "TUPLTYPE") {
+                    token();  // implied by DEPTH
+                } else {
+                    return 0;
+                }
+            }
+        } else {
+            return 0;
+        }
+        if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255 || (depth != 1 && depth != 3 && depth != 4)) {
+            return 0;
+        }
+        if (pos >= size || std::isspace(data[pos]) == 0) {
+            return 0;
+        }
+        width = static_cast<int>(w);
+        height = static_cast<int>(h);
+        layout = depth == 1 ? PixelLayout::Gray8 : depth == 3 ? PixelLayout::RGB24 : PixelLayout::RGBX32;
+        return pos + 1;  // exactly one whitespace byte ends the header
+    }
+
+public:
+    // A Netpbm file, possibly several images of the same size and layout back to back.
+    explicit ImageFile(const std::string& path) : mFile(path) {
+        if (!mFile.ok()) {
+            return;
+        }
+        size_t pos = parseHeader(0, mWidth, mHeight, mLayout);
+        if (pos == 0) {
+            std::cerr << "Unsupported image " << path << ", expected 8 bit P5, P6 or P7." << std::endl;
+            return;
+        }
+        mFrameBytes = static_cast<size_t>(mWidth) * mHeight * bytesPerPixel(mLayout);
+        while (pos != 0 && pos + mFrameBytes <= mFile.size()) {
+            mFrames.push_back(pos);
+            int width = 0, height = 0;
+            PixelLayout layout{};
+            pos = parseHeader(pos + mFrameBytes, width, height, layout);
+            if (width != mWidth || height != mHeight || layout != mLayout) {
+                break;
+            }
+        }
+        if (mFrames.empty()) {
+            std::cerr << "Truncated image " << path << "." << std::endl;
+        }
+    }
+
+    // Headerless width x height frames back to back, e.g. a raw frame dump. A partial frame at
+    // the end is ignored.
+    ImageFile(const std::string& path, const int width, const int height, const PixelLayout layout)
+        : mFile(path), mWidth(width), mHeight(height), mLayout(layout) {
+        mFrameBytes = static_cast<size_t>(width) * height * bytesPerPixel(layout);
+        if (!mFile.ok() || mFrameBytes == 0) {
+            return;
+        }
+        for (size_t pos = 0; pos + mFrameBytes <= mFile.size(); pos += mFrameBytes) {
+            mFrames.push_back(pos);
+        }
+        if (mFrames.empty()) {
+            std::cerr << path << " is smaller than one frame." << std::endl;
+        }
+    }
+
+    bool ok() const { return !mFrames.empty(); }
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    PixelLayout layout() const { return mLayout; }
+    int frames() const { return static_cast<int>(mFrames.size()); }
+
+    // Pixels of a frame, width * bytesPerPixel(layout()) bytes per row.
+    const uint8_t* frame(const int index) const { return mFile.data() + mFrames[index]; }
+
+    // Convert a frame into a cfw::Window and start reading the next one. Present with paint().
+    template <class Win>
+    void render(Win& window, const int index = 0) const {
+        if (index < 0 || index >= frames()) {
+            return;
+        }
+        const size_t stride = static_cast<size_t>(mWidth) * bytesPerPixel(mLayout);
+        renderRows(window, mLayout, frame(index), stride, mWidth, 0, mHeight);
+        if (frames() > 1) {
+            mFile.release(mFrames[index], mFrameBytes);
+            mFile.prefetch(mFrames[(index + 1) % frames()], mFrameBytes);
+        }
+    }
+};
+
+// Incremental decoder for QOI images (qoiformat.org) in a mapped file. decodeRows() continues
+// where the previous call stopped, so render() converts the image a strip at a time through a
+// buffer that stays in cache instead of decoding it whole first.
+class QoiDecoder {
+    MappedFile mFile;
+    int mWidth{0};
+    int mHeight{0};
+    int mRow{0};
+    const uint8_t* mPos{nullptr};
+    const uint8_t* mEnd{nullptr};  // start of the end marker
+    uint8_t mPixel[4]{0, 0, 0, 255};
+    uint8_t mIndex[64][4]{};
+    int mRun{0};
+
+    static constexpr size_t kHeaderBytes = 14;
+    static constexpr size_t kEndBytes = 8;
+    static constexpr size_t kStripBytes = 64 * 1024;
+
+    static uint32_t readBE32(const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) << 24U | static_cast<uint32_t>(p[1]) << 16U |
+               static_cast<uint32_t>(p[2]) << 8U | p[3];
+    }
+
+    // Next pixel into mPixel, false once the data runs out.
+    bool decodePixel() {
+        if (mRun > 0) {
+            --mRun;
+            return true;
+        }
+        if (mPos >= mEnd) {
+            return false;
+        }
+        const uint8_t op = *mPos++;
+        uint8_t* const px = mPixel;
+        if (op == 0xFE) {  // QOI_OP_RGB
+            if (mEnd - mPos < 3) {
+                return false;
+            }
+            px[0] = mPos[0];
+            px[1] = mPos[1];
+            px[2] = mPos[2];
+            mPos += 3;
+        } else if (op == 0xFF) {  // QOI_OP_RGBA
+            if (mEnd - mPos < 4) {
+                return false;
+            }
+            std::memcpy(px, mPos, 4);
+            mPos += 4;
+        } else if ((op & 0xC0U) == 0x00) {  // QOI_OP_INDEX
+            std::memcpy(px, mIndex[op], 4);
+        } else if ((op & 0xC0U) == 0x40) {  // QOI_OP_DIFF
+            px[0] = static_cast<uint8_t>(px[0] + ((op >> 4U) & 3U) - 2);
+            px[1] = static_cast<uint8_t>(px[1] + ((op >> 2U) & 3U) - 2);
+            px[2] = static_cast<uint8_t>(px[2] + (op & 3U) - 2);
+        } else if ((op & 0xC0U) == 0x80) {  // QOI_OP_LUMA
+            if (mPos >= mEnd) {
+                return false;
+            }
+            const int dg = static_cast<int>(op & 0x3FU) - 32;
+            const uint8_t next = *mPos++;
+            px[0] = static_cast<uint8_t>(px[0] + dg - 8 + (next >> 4U));
+            px[1] = static_cast<uint8_t>(px[1] + dg);
+            px[2] = static_cast<uint8_t>(px[2] + dg - 8 + (next & 0x0FU));
+        } else {  // QOI_OP_RUN, this pixel and up to 61 more
+            mRun = op & 0x3F;
+        }
+        std::memcpy(mIndex[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        return true;
+    }
+
+public:
+    explicit QoiDecoder(const std::string& path) : mFile(path) {
+        if (!mFile.ok()) {
+            return;
+        }
+        const uint8_t* const data = mFile.data();
+        if (mFile.size() < kHeaderBytes + kEndBytes || std::memcmp(data, "qoif", 4) != 0 || data[12] < 3 ||
+            data[12] > 4) {
+            std::cerr << path << " is not a QOI image." << std::endl;
+            return;
+        }
+        const uint32_t width = readBE32(data + 4);
+        const uint32_t height = readBE32(data + 8);
+        if (width == 0 || height == 0 || width > (1U << 16U) || height > (1U << 16U)) {
+            std::cerr << path << " has an unsupported size." << std::endl;
+            return;
+        }
+        mWidth = static_cast<int>(width);
+        mHeight = static_cast<int>(height);
+        rewind();
+    }
+
+    bool ok() const { return mWidth > 0; }
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+
+    // Rows decoded so far.
+    int row() const { return mRow; }
+
+    void rewind() {
+        mPos = mFile.data() + kHeaderBytes;
+        mEnd = mFile.data() + mFile.size() - kEndBytes;
+        mRow = 0;
+        mRun = 0;
+        mPixel[0] = mPixel[1] = mPixel[2] = 0;
+        mPixel[3] = 255;
+        std::memset(mIndex, 0, sizeof(mIndex));
+    }
+
+    // Decode up to rows more rows as RGBA, width() * 4 bytes per row. Returns the rows decoded;
+    // rows cut short by truncated data are completed with the last pixel.
+    int decodeRows(uint8_t* out, int rows) {
+        rows = std::min(rows, mHeight - mRow);
+        bool more = true;
+        for (int i = 0; i < rows * mWidth; ++i) {
+            more = more && decodePixel();
+            std::memcpy(out + static_cast<size_t>(i) * 4, mPixel, 4);
+        }
+        mRow += std::max(0, rows);
+        return std::max(0, rows);
+    }
+
+    // Decode the image from the start into a cfw::Window strip by strip. Present with paint().
+    template <class Win>
+    void render(Win& window) {
+        if (!ok()) {
+            return;
+        }
+        rewind();
+        const size_t stride = static_cast<size_t>(mWidth) * 4;
+        const int strip = std::max(1, static_cast<int>(kStripBytes / stride));
+        // Stream the stores when the whole image would, as render() does.
+        const Store store = stride * mHeight >= kStreamingStoreBytes ? Store::Streaming : Store::Cached;
+        std::vector<uint8_t> rows(stride * strip);
+        while (mRow < mHeight) {
+            const int y = mRow;
+            const int count = decodeRows(rows.data(), strip);
+            renderRows(window, PixelLayout::RGBX32, rows.data(), stride, mWidth, y, count, store);
+        }
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_IMAGE_SOURCE_H
@@ -0,0 +1,274 @@
+#ifndef CFW_INPUT_LOG_H
+#define CFW_INPUT_LOG_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cfw {
+
+// One dispatched input event.
+struct InputEvent {
+    enum class Type : uint8_t { Key, Char, Mouse, Close };
+
+    Type type{Type::Close};
+    uint64_t time{0};     // read from a log: nanoseconds since the recording started
+    uint64_t arrival{0};  // given to an event callback: steady_clock time in nanoseconds
+    uint8_t key{0};  // cfw::Keys value
+    bool pressed{false};
+    char text[8]{};  // NUL terminated UTF-8
+    int32_t x{-1};
+    int32_t y{-1};
+    uint32_t buttons{0};
+    int32_t wheel{0};
+};
+
+// Log file layout: "CFWI" magic, u8 version, then one record per event:
+// u8 type, varint time delta in microseconds, and a type specific payload
+//   Key:   u8 key, u8 pressed
+//   Char:  u8 length, bytes
+//   Mouse: zigzag varints x, y, wheel and a varint button mask
+//   Close: nothing
+namespace inputlog {
+constexpr char kMagic[4] = {'C', 'F', 'W', 'I'};
+constexpr uint8_t kVersion = 1;
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80U) {
+        out.push_back(static_cast<uint8_t>(v | 0x80U));
+        v >>= 7U;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline void putSigned(std::vector<uint8_t>& out, const int64_t v) {
+    putVarint(out, (static_cast<uint64_t>(v) << 1U) ^ static_cast<uint64_t>(v >> 63));
+}
+
+inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (unsigned int shift = 0; p != end && shift < 64; shift += 7) {
+        const uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7fU) << shift;
+        if ((b & 0x80U) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool getSigned(const uint8_t*& p, const uint8_t* end, int32_t& v) {
+    uint64_t u = 0;
+    if (!getVarint(p, end, u)) {
+        return false;
+    }
+    v = static_cast<int32_t>(static_cast<int64_t>(u >> 1U) ^ -static_cast<int64_t>(u & 1U));
+    return true;
+}
+}  // namespace inputlog
+
+// Appends dispatched events to a log file. Safe to feed from the event thread.
+class InputRecorder {
+    using Clock = std::chrono::steady_clock;
+
+    std::FILE* mFile{nullptr};
+    std::mutex mMutex;
+    std::vector<uint8_t> mBuffer;
+    Clock::time_point mStart;
+    uint64_t mLastUs{0};
+
+    void begin(const InputEvent::Type type) {
+        const uint64_t us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - mStart).count());
+        mBuffer.push_back(static_cast<uint8_t>(type));
+        inputlog::putVarint(mBuffer, us - mLastUs);
+        mLastUs = us;
+    }
+
+    void end() {
+        // Events are rare compared to the write cost, but bursts (mouse motion) are batched.
+        if (mBuffer.size() >= 4096) {
+            flushLocked();
+        }
+    }
+
+    void flushLocked() {
+        if (mFile != nullptr && !mBuffer.empty()) {
+            std::fwrite(mBuffer.data(), 1, mBuffer.size(), mFile);
+            std::fflush(mFile);
+        }
+        mBuffer.clear();
+    }
+
+public:
+    explicit InputRecorder(const std::string& path) : mStart(Clock::now()) {
+        mFile = std::fopen(path.c_str(), "wb");
+        if (mFile == nullptr) {
+            std::cerr << "Failed to open input log " << path << "." << std::endl;
+            return;
+        }
+        mBuffer.assign(inputlog::kMagic, inputlog::kMagic + 4);
+        mBuffer.push_back(inputlog::kVersion);
+    }
+
+    ~InputRecorder() {
+        if (mFile != nullptr) {
+            flushLocked();
+            std::fclose(mFile);
+        }
+    }
+
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder(InputRecorder&&) = delete;
+    void operator=(const InputRecorder&) = delete;
+    void operator=(InputRecorder&&) = delete;
+
+    bool ok() const { return mFile != nullptr; }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        flushLocked();
+    }
+
+    void key(const uint8_t key, const bool pressed) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        begin(InputEvent::Type::Key);
+        mBuffer.push_back(key);
+        mBuffer.push_back(pressed ? 1 : 0);
+        end();
+    }
+
+    void text(const char* chars) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        begin(InputEvent::Type::Char);
+        const size_t len = std::min<size_t>(std::strlen(chars), sizeof(InputEvent::text) - 1);
+        mBuffer.push_back(static_cast<uint8_t>(len));
+        mBuffer.insert(mBuffer.end(), chars, chars + len);
+        end();
+    }
+
+    void mouse(const int32_t x, const int32_t y, const uint32_t buttons, const int32_t wheel) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        begin(InputEvent::Type::Mouse);
+        inputlog::putSigned(mBuffer, x);
+        inputlog::putSigned(mBuffer, y);
+        inputlog::putSigned(mBuffer, wheel);
+        inputlog::putVarint(mBuffer, buttons);
+        end();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        begin(InputEvent::Type::Close);
+        end();
+    }
+};
+
+// Loads a log written by InputRecorder and feeds it back to a window.
+class InputReplay {
+public:
+    enum class Timing {
+        Original,  // sleep so events are delivered at their recorded offsets
+        Fast,      // deliver back to back
+    };
+
+private:
+    std::vector<InputEvent> mEvents;
+    bool mOk{false};
+
+public:
+    explicit InputReplay(const std::string& path) {
+        std::FILE* const file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open input log " << path << "." << std::endl;
+            return;
+        }
+        std::vector<uint8_t> data;
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            data.insert(data.end(), chunk, chunk + n);
+        }
+        std::fclose(file);
+
+        if (data.size() < 5 || std::memcmp(data.data(), inputlog::kMagic, 4) != 0 || data[4] != inputlog::kVersion) {
+            std::cerr << "Invalid input log " << path << "." << std::endl;
+            return;
+        }
+        const uint8_t* p = data.data() + 5;
+        const uint8_t* const end = data.data() + data.size();
+        uint64_t time = 0;
+        while (p != end) {
+            InputEvent event;
+            event.type = static_cast<InputEvent::Type>(*p++);
+            uint64_t delta = 0;
+            if (!inputlog::getVarint(p, end, delta)) {
+                break;
+            }
+            time += delta * 1000;
+            event.time = time;
+            bool complete = true;
+            switch (event.type) {
+                case InputEvent::Type::Key:
+                    complete = end - p >= 2;
+                    if (complete) {
+                        event.key = *p++;
+                        event.pressed = *p++ != 0;
+                    }
+                    break;
+                case InputEvent::Type::Char: {
+                    complete = p != end && end - p > *p && *p < sizeof(event.text);
+                    if (complete) {
+                        const uint8_t len = *p++;
+                        std::memcpy(event.text, p, len);
+                        p += len;
+                    }
+                } break;
+                case InputEvent::Type::Mouse: {
+                    uint64_t buttons = 0;
+                    complete = inputlog::getSigned(p, end, event.x) && inputlog::getSigned(p, end, event.y) &&
+                               inputlog::getSigned(p, end, event.wheel) && inputlog::getVarint(p, end, buttons);
+                    event.buttons = static_cast<uint32_t>(buttons);
+                } break;
+                case InputEvent::Type::Close:
+                    break;
+                default:
+                    complete = false;
+                    break;
+            }
+            if (!complete) {
+                std::cerr << "Truncated input log " << path << "." << std::endl;
+                break;
+            }
+            mEvents.push_back(event);
+        }
+        mOk = true;
+    }
+
+    bool ok() const { return mOk; }
+    const std::vector<InputEvent>& events() const { return mEvents; }
+
+    // Calls inject(const InputEvent&) for every event, returns the number delivered.
+    template <class Inject>
+    size_t run(Inject&& inject, const Timing timing = Timing::Original) const {
+        const auto start = std::chrono::steady_clock::now();
+        for (const InputEvent& event : mEvents) {
+            if (timing == Timing::Original) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(event.time));
+            }
+            inject(event);
+        }
+        return mEvents.size();
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_INPUT_LOG_H
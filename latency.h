@@ -0,0 +1,107 @@
+#ifndef CFW_LATENCY_H
+#define CFW_LATENCY_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace cfw {
+
+// Arrival of one input event, see WindowBase::lastInputId().
+struct InputStamp {
+    uint64_t id{0};
+    uint32_t serverTime{0};  // window system timestamp in ms, 0 if the event had none
+    std::chrono::steady_clock::time_point arrival{};
+};
+
+// Lock-free latency histogram. Buckets split every power of two of microseconds in
+// four, so the reported percentiles are within 25% of the true value.
+class LatencyHistogram {
+    static constexpr int kBuckets = 4 * 40;
+
+    std::array<std::atomic<uint64_t>, kBuckets> mCounts{};
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mSumUs{0};
+    std::atomic<uint64_t> mMaxUs{0};
+
+    static int bucketOf(const uint64_t us) {
+        if (us < 4) {
+            return static_cast<int>(us);
+        }
+        int msb = 0;
+        while ((us >> (msb + 1)) != 0) {
+            ++msb;
+        }
+        const int index = msb * 4 + static_cast<int>((us >> (msb - 2)) & 3U);
+        return index < kBuckets ? index : kBuckets - 1;
+    }
+
+    // Exclusive upper bound of a bucket, in microseconds.
+    static uint64_t bucketLimit(const int index) {
+        if (index < 4) {
+            return static_cast<uint64_t>(index) + 1;
+        }
+        return static_cast<uint64_t>(4 + index % 4 + 1) << (index / 4 - 2);
+    }
+
+public:
+    void add(const std::chrono::steady_clock::duration latency) {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        const uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+        ++mCounts[bucketOf(value)];
+        ++mCount;
+        mSumUs += value;
+        uint64_t max = mMaxUs;
+        while (value > max && !mMaxUs.compare_exchange_weak(max, value)) {
+        }
+    }
+
+    void reset() {
+        for (auto& count : mCounts) {
+            count = 0;
+        }
+        mCount = mSumUs = mMaxUs = 0;
+    }
+
+    uint64_t count() const { return mCount; }
+    double meanMs() const { return mCount != 0 ? static_cast<double>(mSumUs) / 1000.0 / mCount : 0.0; }
+    double maxMs() const { return static_cast<double>(mMaxUs) / 1000.0; }
+
+    // Upper bound of the bucket holding the given percentile (0-100), capped by the maximum.
+    double percentileMs(const double percentile) const {
+        const uint64_t total = mCount;
+        if (total == 0) {
+            return 0.0;
+        }
+        const auto rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += mCounts[i];
+            if (seen >= rank) {
+                return std::min(static_cast<double>(bucketLimit(i)) / 1000.0, maxMs());
+            }
+        }
+        return maxMs();
+    }
+
+    void print(std::ostream& out) const {
+        out << "n=" << count() << " mean=" << meanMs() << "ms p50=" << percentileMs(50)
+            << "ms p90=" << percentileMs(90) << "ms p99=" << percentileMs(99) << "ms max=" << maxMs() << "ms\n";
+        const uint64_t total = mCount;
+        for (int i = 0; i < kBuckets && total != 0; ++i) {
+            const uint64_t n = mCounts[i];
+            if (n != 0) {
+                out << "  <" << static_cast<double>(bucketLimit(i)) / 1000.0 << "ms\t" << n << '\t'
+                    << std::string(static_cast<size_t>(1 + 60 * n / total), '#') << '\n';
+            }
+        }
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_LATENCY_H
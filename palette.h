@@ -0,0 +1,124 @@
+#ifndef CFW_PALETTE_H
+#define CFW_PALETTE_H
+
+#include "formats.h"
+#include "framebuffer.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace cfw {
+
+// 256 entry color table for renderIndexed(), kept packed as native 0x00RRGGBB words so the
+// common visual needs no repacking. Changing entries is O(1); windows repack lazily.
+class Palette {
+    std::array<uint32_t, 256> mEntries{};
+    uint64_t mVersion{nextVersion()};
+
+    // Versions are unique across all palettes, so a new palette at a recycled address never
+    // matches a table packed for the old one.
+    static uint64_t nextVersion() {
+        static std::atomic<uint64_t> sVersion{0};
+        return ++sVersion;
+    }
+
+public:
+    Palette() = default;
+    Palette(const Palette& other) : mEntries(other.mEntries) {}
+    Palette& operator=(const Palette& other) {
+        mEntries = other.mEntries;
+        mVersion = nextVersion();
+        return *this;
+    }
+
+    // rgb holds count R, G, B triplets.
+    explicit Palette(const uint8_t* rgb, const int count = 256) { set(rgb, count); }
+
+    void set(const uint8_t index, const uint8_t r, const uint8_t g, const uint8_t b) {
+        mEntries[index] = static_cast<uint32_t>(r) << 16U | static_cast<uint32_t>(g) << 8U | b;
+        mVersion = nextVersion();
+    }
+
+    void set(const uint8_t* rgb, const int count, const int first = 0) {
+        for (int i = first; i < std::min(256, first + count); ++i, rgb += 3) {
+            mEntries[i] = static_cast<uint32_t>(rgb[0]) << 16U | static_cast<uint32_t>(rgb[1]) << 8U | rgb[2];
+        }
+        mVersion = nextVersion();
+    }
+
+    uint32_t operator[](const uint8_t index) const { return mEntries[index]; }
+    const uint32_t* data() const { return mEntries.data(); }
+
+    // Renewed on every change and copy, used by windows to notice edits without comparing tables.
+    uint64_t version() const { return mVersion; }
+};
+
+// A palette packed for a particular visual. Returns the palette's own table when the visual
+// already is native XRGB, otherwise repacks only after the palette changed.
+class PackedPalette {
+    std::array<uint32_t, 256> mPacked{};
+    const Palette* mSource{nullptr};
+    uint64_t mVersion{0};
+
+public:
+    const uint32_t* get(const Palette& palette, const VisualFormat& visual) {
+        if (!visual.bgr && visual.bigEndian == kHostBigEndian) {
+            return palette.data();
+        }
+        if (mSource != &palette || mVersion != palette.version()) {
+            std::array<uint8_t, 256 * 3> rgb;
+            for (int i = 0; i < 256; ++i) {
+                rgb[i * 3] = static_cast<uint8_t>(palette[i] >> 16U);
+                rgb[i * 3 + 1] = static_cast<uint8_t>(palette[i] >> 8U);
+                rgb[i * 3 + 2] = static_cast<uint8_t>(palette[i]);
+            }
+            convertImage<format::RGB24>(rgb.data(), 256, 1, Framebuffer{mPacked.data(), 256, 1, 256}, visual);
+            mSource = &palette;
+            mVersion = palette.version();
+        }
+        return mPacked.data();
+    }
+};
+
+// One table lookup per pixel, gathered eight at a time with AVX2, unrolled by four otherwise.
+inline void lookupRow(const uint8_t* src, uint32_t* dst, int count, const uint32_t* lut) {
+#if defined(__AVX2__)
+    for (; count >= 8; count -= 8, src += 8, dst += 8) {
+        const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                            _mm256_i32gather_epi32(reinterpret_cast<const int*>(lut), index, 4));
+    }
+#endif
+    for (; count >= 4; count -= 4, src += 4, dst += 4) {
+        dst[0] = lut[src[0]];
+        dst[1] = lut[src[1]];
+        dst[2] = lut[src[2]];
+        dst[3] = lut[src[3]];
+    }
+    for (; count > 0; --count) {
+        *dst++ = lut[*src++];
+    }
+}
+
+// Expand a width x height image of palette indices into the framebuffer, clipped to both.
+inline void lookupImage(const uint8_t* src, const int width, const int height, const Framebuffer& fb,
+                        const uint32_t* lut) {
+    const int rows = std::min(height, fb.height);
+    const int cols = std::min(width, fb.width);
+    if (cols == fb.stride && cols == width) {
+        lookupRow(src, fb.pixels, cols * rows, lut);
+        return;
+    }
+    for (int y = 0; y < rows; ++y) {
+        lookupRow(src + static_cast<ptrdiff_t>(y) * width, fb.row(y), cols, lut);
+    }
+}
+
+}  // namespace cfw
+
+#endif  // CFW_PALETTE_H
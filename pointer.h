@@ -0,0 +1,85 @@
+#ifndef CFW_POINTER_H
+#define CFW_POINTER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace cfw {
+
+// One pointer sample. Positions are subpixel when the backend provides them (XInput2).
+struct PointerSample {
+    float x{-1};
+    float y{-1};
+    uint32_t buttons{0};  // same bits as the mouse callback: 1 left, 2 right, 4 middle
+    float scrollX{0};     // wheel notches, positive is right
+    float scrollY{0};     // wheel notches, positive is up
+    uint32_t time{0};     // window system timestamp in ms
+    std::chrono::steady_clock::time_point arrival{};
+};
+
+enum class Coalescing {
+    Latest,        // one sample per batch and button state
+    All,           // every sample the window system delivered
+    TimeBucketed,  // one sample per time bucket and button state
+};
+
+// Collects the samples of one event batch and merges them according to the coalescing mode.
+// Button changes are never merged away and scroll amounts are summed, so no click or wheel
+// notch is lost whatever the mode.
+class PointerBatcher {
+    std::vector<PointerSample> mSamples;
+    std::atomic<Coalescing> mMode{Coalescing::Latest};
+    std::atomic<uint32_t> mBucketMs{4};
+
+    bool merges(const PointerSample& last, const PointerSample& next) const {
+        if (last.buttons != next.buttons) {
+            return false;
+        }
+        switch (mMode.load()) {
+            case Coalescing::Latest:
+                return true;
+            case Coalescing::TimeBucketed: {
+                const uint32_t bucket = mBucketMs != 0 ? mBucketMs.load() : 1;
+                return last.time / bucket == next.time / bucket;
+            }
+            case Coalescing::All:
+                break;
+        }
+        return false;
+    }
+
+public:
+    void setMode(const Coalescing mode, const uint32_t bucketMs) {
+        mMode = mode;
+        mBucketMs = bucketMs;
+    }
+
+    void add(const PointerSample& sample) {
+        if (!mSamples.empty() && merges(mSamples.back(), sample)) {
+            PointerSample& last = mSamples.back();
+            const float scrollX = last.scrollX + sample.scrollX;
+            const float scrollY = last.scrollY + sample.scrollY;
+            last = sample;
+            last.scrollX = scrollX;
+            last.scrollY = scrollY;
+        } else {
+            mSamples.push_back(sample);
+        }
+    }
+
+    bool empty() const { return mSamples.empty(); }
+
+    template <class Func>
+    void flush(Func&& func) {
+        if (!mSamples.empty()) {
+            func(mSamples.data(), mSamples.size());
+            mSamples.clear();
+        }
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_POINTER_H
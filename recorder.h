@@ -0,0 +1,236 @@
+#ifndef CFW_RECORDER_H
+#define CFW_RECORDER_H
+
+#include "framebuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cfw {
+
+// Streams presented frames to disk on a writer thread. capture() only copies the frame
+// into a free pool buffer and never waits for the disk: when the pool is exhausted the
+// frame is dropped and counted.
+class Recorder {
+public:
+    enum class Format {
+        Y4M,      // YUV4MPEG2, 4:4:4 BT.601 limited range, playable with ffplay/mpv
+        RawRGBA,  // headerless R, G, B, 255 bytes per pixel
+    };
+
+private:
+    // Output is staged in blocks this large and written with one call each.
+    static constexpr size_t kBlockSize = 4U << 20U;
+    static constexpr size_t kAlignment = 4096;
+
+    struct AlignedFree {
+        void operator()(uint8_t* p) const { std::free(p); }
+    };
+
+    const Format mFormat;
+    const int mWidth;
+    const int mHeight;
+    std::FILE* mFile{nullptr};
+
+    std::vector<std::unique_ptr<uint32_t[]>> mFrames;
+    std::vector<uint32_t*> mFree;
+    std::deque<Framebuffer> mQueue;  // pool frames with the channel layout they were captured in
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopping{false};
+    std::thread mWriter;
+
+    std::unique_ptr<uint8_t, AlignedFree> mBlock;
+    size_t mBlockUsed{0};
+    std::vector<uint8_t> mPlanes;
+
+    std::atomic<uint64_t> mCaptured{0};
+    std::atomic<uint64_t> mDropped{0};
+    std::atomic<bool> mFailed{false};
+
+    void flushBlock() {
+        if (mBlockUsed != 0 && !mFailed) {
+            if (std::fwrite(mBlock.get(), 1, mBlockUsed, mFile) != mBlockUsed) {
+                mFailed = true;
+            }
+        }
+        mBlockUsed = 0;
+    }
+
+    void put(const uint8_t* data, size_t size) {
+        while (size > 0) {
+            const size_t n = std::min(size, kBlockSize - mBlockUsed);
+            std::memcpy(mBlock.get() + mBlockUsed, data, n);
+            mBlockUsed += n;
+            data += n;
+            size -= n;
+            if (mBlockUsed == kBlockSize) {
+                flushBlock();
+            }
+        }
+    }
+
+    void encode(const Framebuffer& fb) {
+        const size_t count = static_cast<size_t>(mWidth) * mHeight;
+        const uint32_t* const frame = fb.pixels;
+        const unsigned int sr = fb.shiftR;
+        const unsigned int sg = fb.shiftG;
+        const unsigned int sb = fb.shiftB;
+        uint8_t* out = mPlanes.data();
+        if (mFormat == Format::RawRGBA) {
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t p = frame[i];
+                *out++ = static_cast<uint8_t>(p >> sr);
+                *out++ = static_cast<uint8_t>(p >> sg);
+                *out++ = static_cast<uint8_t>(p >> sb);
+                *out++ = 255;
+            }
+        } else {
+            static const char kFrameHeader[] = "FRAME\n";
+            put(reinterpret_cast<const uint8_t*>(kFrameHeader), sizeof(kFrameHeader) - 1);
+            uint8_t* const py = out;
+            uint8_t* const pu = py + count;
+            uint8_t* const pv = pu + count;
+            for (size_t i = 0; i < count; ++i) {
+                const int r = static_cast<int>((frame[i] >> sr) & 0xffU);
+                const int g = static_cast<int>((frame[i] >> sg) & 0xffU);
+                const int b = static_cast<int>((frame[i] >> sb) & 0xffU);
+                py[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                pu[i] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                pv[i] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+        put(mPlanes.data(), mPlanes.size());
+    }
+
+    void writerThread() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;) {
+            mCondition.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+            if (mQueue.empty()) {
+                break;
+            }
+            const Framebuffer frame = mQueue.front();
+            mQueue.pop_front();
+            lock.unlock();
+            encode(frame);
+            lock.lock();
+            mFree.push_back(frame.pixels);
+        }
+        lock.unlock();
+        flushBlock();
+        std::fflush(mFile);
+    }
+
+public:
+    // poolSize is the number of frames that may wait for the writer before frames are dropped.
+    Recorder(const std::string& path, const Format format, const int width, const int height, const int fps = 60,
+             const size_t poolSize = 8)
+        : mFormat(format), mWidth(width), mHeight(height) {
+        mFile = std::fopen(path.c_str(), "wb");
+        if (mFile == nullptr) {
+            std::cerr << "Failed to open recording file " << path << "." << std::endl;
+            mFailed = true;
+            return;
+        }
+        // Writes are already block sized, stdio buffering would only add a copy.
+        std::setvbuf(mFile, nullptr, _IONBF, 0);
+
+        void* block = nullptr;
+#if defined(_WIN32)
+        block = std::malloc(kBlockSize);
+#else
+        if (posix_memalign(&block, kAlignment, kBlockSize) != 0) {
+            block = nullptr;
+        }
+#endif
+        mBlock.reset(static_cast<uint8_t*>(block));
+        if (!mBlock) {
+            mFailed = true;
+            return;
+        }
+
+        const size_t count = static_cast<size_t>(width) * height;
+        mPlanes.resize(count * (format == Format::RawRGBA ? 4 : 3));
+        for (size_t i = 0; i < poolSize; ++i) {
+            mFrames.emplace_back(new uint32_t[count]);
+            mFree.push_back(mFrames.back().get());
+        }
+
+        if (format == Format::Y4M) {
+            char header[96];
+            const int n = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width,
+                                        height, fps);
+            put(reinterpret_cast<const uint8_t*>(header), static_cast<size_t>(n));
+        }
+        mWriter = std::thread(&Recorder::writerThread, this);
+    }
+
+    ~Recorder() {
+        if (mWriter.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStopping = true;
+            }
+            mCondition.notify_one();
+            mWriter.join();
+        }
+        if (mFile != nullptr) {
+            std::fclose(mFile);
+        }
+    }
+
+    Recorder(const Recorder&) = delete;
+    Recorder(Recorder&&) = delete;
+    void operator=(const Recorder&) = delete;
+    void operator=(Recorder&&) = delete;
+
+    // Copy the frame into the pool and hand it to the writer. Returns false if it was dropped.
+    // Channels are read with fb's layout, so captures match what was displayed on any visual.
+    bool capture(const Framebuffer& fb) {
+        if (mFailed || fb.pixels == nullptr) {
+            ++mDropped;
+            return false;
+        }
+        uint32_t* frame = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mFree.empty()) {
+                ++mDropped;
+                return false;
+            }
+            frame = mFree.back();
+            mFree.pop_back();
+        }
+        const int rows = std::min(mHeight, fb.height);
+        const int cols = std::min(mWidth, fb.width);
+        for (int y = 0; y < rows; ++y) {
+            std::memcpy(frame + static_cast<size_t>(y) * mWidth, fb.row(y), cols * sizeof(uint32_t));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueue.push_back({frame, mWidth, mHeight, mWidth, fb.shiftR, fb.shiftG, fb.shiftB});
+        }
+        mCondition.notify_one();
+        ++mCaptured;
+        return true;
+    }
+
+    uint64_t captured() const { return mCaptured; }
+    uint64_t dropped() const { return mDropped; }
+    bool failed() const { return mFailed; }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_RECORDER_H
@@ -0,0 +1,151 @@
+#ifndef CFW_SNAPSHOT_H
+#define CFW_SNAPSHOT_H
+
+#include "formats.h"
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cfw {
+
+// Shared between a window and its snapshots. Points into the window's image until the window
+// is about to change it, at which point the pixels are copied once (copy-on-write).
+class SnapshotState {
+    std::mutex mMutex;
+    const uint32_t* mPixels;
+    int mWidth;
+    int mHeight;
+    int mStride;
+    Framebuffer mLayout;  // channel shifts of the window's image
+    std::vector<uint32_t> mCopy;
+
+    friend class Snapshot;
+
+public:
+    explicit SnapshotState(const Framebuffer& fb)
+        : mPixels(fb.pixels), mWidth(fb.width), mHeight(fb.height), mStride(fb.stride), mLayout(fb) {}
+
+    // Called by the window before it writes the image. Waits for readers holding the lock.
+    void detach() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mCopy.empty() || mPixels == nullptr) {
+            return;
+        }
+        mCopy.resize(static_cast<size_t>(mWidth) * mHeight);
+        for (int y = 0; y < mHeight; ++y) {
+            std::copy_n(mPixels + static_cast<ptrdiff_t>(y) * mStride, mWidth,
+                        mCopy.data() + static_cast<ptrdiff_t>(y) * mWidth);
+        }
+        mPixels = mCopy.data();
+        mStride = mWidth;
+    }
+};
+
+// Downscaled copy of a snapshot, native 0x00RRGGBB pixels.
+struct Thumbnail {
+    std::vector<uint32_t> pixels;
+    int width{0};
+    int height{0};
+};
+
+// Average each factor x factor block into one pixel, factor 1-256, reading channels at the given
+// word shifts (see Framebuffer). Partial blocks at the right and bottom edges are dropped. Rows are summed vertically with SSE2 into 16 bit lanes, then each
+// row of sums is reduced horizontally, so the source is read once, sequentially.
+inline Thumbnail boxFilter(const uint32_t* pixels, const int width, const int height, const int stride, int factor,
+                           const unsigned int shiftR = 16, const unsigned int shiftG = 8,
+                           const unsigned int shiftB = 0) {
+    factor = std::min(256, std::max(1, factor));
+    const auto byteOf = [](const unsigned int shift) {
+        return static_cast<int>(kHostBigEndian ? 3 - shift / 8 : shift / 8);
+    };
+    const int rByte = byteOf(shiftR);
+    const int gByte = byteOf(shiftG);
+    const int bByte = byteOf(shiftB);
+    Thumbnail out;
+    out.width = width / factor;
+    out.height = height / factor;
+    out.pixels.resize(static_cast<size_t>(out.width) * out.height);
+    const int cols = out.width * factor;
+    const uint32_t area = static_cast<uint32_t>(factor) * static_cast<uint32_t>(factor);
+    std::vector<uint16_t> sums(static_cast<size_t>(cols) * 4);  // the 4 bytes of each column's pixels
+
+    for (int oy = 0; oy < out.height; ++oy) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int sy = oy * factor; sy < (oy + 1) * factor; ++sy) {
+            const auto* const src = reinterpret_cast<const uint8_t*>(pixels + static_cast<ptrdiff_t>(sy) * stride);
+            int x = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 4 <= cols; x += 4) {
+                const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+                auto* const lo = reinterpret_cast<__m128i*>(sums.data() + x * 4);
+                auto* const hi = reinterpret_cast<__m128i*>(sums.data() + x * 4 + 8);
+                _mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(p, zero)));
+                _mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(p, zero)));
+            }
+#endif
+            for (; x < cols; ++x) {
+                for (int c = 0; c < 4; ++c) {
+                    sums[x * 4 + c] = static_cast<uint16_t>(sums[x * 4 + c] + src[x * 4 + c]);
+                }
+            }
+        }
+        uint32_t* const dst = out.pixels.data() + static_cast<ptrdiff_t>(oy) * out.width;
+        for (int ox = 0; ox < out.width; ++ox) {
+            uint32_t b = 0, g = 0, r = 0;
+            for (int x = ox * factor; x < (ox + 1) * factor; ++x) {
+                r += sums[x * 4 + rByte];
+                g += sums[x * 4 + gByte];
+                b += sums[x * 4 + bByte];
+            }
+            dst[ox] = (r + area / 2) / area << 16U | (g + area / 2) / area << 8U | (b + area / 2) / area;
+        }
+    }
+    return out;
+}
+
+// Reference-counted, read-only view of a window's image as it was when taken, see
+// Window::snapshot(). Taking one copies nothing; the window copies the pixels only if it is about
+// to draw while the snapshot is still alive. To read pixels() from another thread than the one
+// rendering, hold the snapshot locked (it is BasicLockable, e.g. std::lock_guard<Snapshot>).
+class Snapshot {
+    std::shared_ptr<SnapshotState> mState;
+
+public:
+    Snapshot() = default;
+    explicit Snapshot(std::shared_ptr<SnapshotState> state) : mState(std::move(state)) {}
+
+    explicit operator bool() const { return mState != nullptr; }
+
+    void lock() { mState->mMutex.lock(); }
+    void unlock() { mState->mMutex.unlock(); }
+
+    // Pixels are in the window's layout, rgb() converts one to native 0x00RRGGBB.
+    const uint32_t* pixels() const { return mState ? mState->mPixels : nullptr; }
+    const uint32_t* row(const int y) const { return pixels() + static_cast<ptrdiff_t>(y) * stride(); }
+    int width() const { return mState ? mState->mWidth : 0; }
+    int height() const { return mState ? mState->mHeight : 0; }
+    int stride() const { return mState ? mState->mStride : 0; }
+    uint32_t rgb(const uint32_t pixel) const { return mState ? mState->mLayout.rgb(pixel) : pixel; }
+
+    Thumbnail thumbnail(const int factor) {
+        if (!mState) {
+            return {};
+        }
+        std::lock_guard<std::mutex> lock(mState->mMutex);
+        const Framebuffer& layout = mState->mLayout;
+        return boxFilter(mState->mPixels, mState->mWidth, mState->mHeight, mState->mStride, factor, layout.shiftR,
+                         layout.shiftG, layout.shiftB);
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_SNAPSHOT_H
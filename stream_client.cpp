@@ -0,0 +1,112 @@
+#include "cfw.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+// Viewer and benchmark for a window served with startStreaming():
+//   stream_client <socket> [view]          mirror the stream in a window
+//   stream_client <socket> bench [seconds] read the stream and report throughput
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Convert rows of the mirrored image, whose bytes are laid out as in the serving window's image.
+void renderStrip(cfw::Window& window, const cfw::StreamReader& reader, const cfw::Rect& area) {
+  const auto* const data = reinterpret_cast<const uint8_t*>(reader.pixels() + static_cast<size_t>(area.y) * reader.width());
+  const size_t stride = static_cast<size_t>(reader.width()) * 4;
+  const cfw::VisualFormat visual = reader.visual();
+  const bool xFirst = visual.bigEndian;  // bytes X, R, G, B or X, B, G, R
+  if (visual.bgr == xFirst) {
+    if (xFirst) {
+      window.renderRows<cfw::format::Source<4, 3, 2, 1>>(data, stride, reader.width(), area.y, area.height);
+    } else {
+      window.renderRows<cfw::format::BGRX32>(data, stride, reader.width(), area.y, area.height);
+    }
+  } else {
+    if (xFirst) {
+      window.renderRows<cfw::format::Source<4, 1, 2, 3>>(data, stride, reader.width(), area.y, area.height);
+    } else {
+      window.renderRows<cfw::format::RGBX32>(data, stride, reader.width(), area.y, area.height);
+    }
+  }
+}
+
+int view(cfw::StreamReader& reader) {
+  cfw::Rect damage;
+  if (!reader.read(&damage)) {
+    return 1;
+  }
+  cfw::Window window(reader.width(), reader.height(), "cfw stream");
+  bool going = true;
+  window.setCloseCallback([&going]() { going = false; });
+  window.setKeyCallback([&going](const cfw::Keys& key, bool pressed) {
+    if (pressed && (key == cfw::Keys::ESC || key == cfw::Keys::Q)) {
+      going = false;
+    }
+  });
+
+  while (going) {
+    // Only the rows the update touched are converted and presented.
+    const cfw::Rect rows{0, damage.y, reader.width(), damage.height};
+    renderStrip(window, reader, rows);
+    window.paint(damage);
+
+    pollfd fd{reader.fd(), POLLIN, 0};
+    while (going && poll(&fd, 1, 100) == 0) {
+    }
+    if (going && !reader.read(&damage)) {
+      std::cerr << "Stream closed." << std::endl;
+      break;
+    }
+  }
+  return 0;
+}
+
+int bench(cfw::StreamReader& reader, const double seconds) {
+  uint64_t updates = 0;
+  Clock::duration decode{};
+  const Clock::time_point start = Clock::now();
+  while (Clock::now() - start < std::chrono::duration<double>(seconds)) {
+    pollfd fd{reader.fd(), POLLIN, 0};
+    if (poll(&fd, 1, 100) == 0) {
+      continue;
+    }
+    const Clock::time_point t0 = Clock::now();
+    if (!reader.read()) {
+      std::cerr << "Stream closed." << std::endl;
+      break;
+    }
+    decode += Clock::now() - t0;
+    ++updates;
+  }
+  const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  const double wire = static_cast<double>(reader.wireBytes());
+  const double raw = static_cast<double>(reader.rawBytes());
+  printf("%dx%d: %llu updates in %.1f s, %.1f updates/s\n", reader.width(), reader.height(),
+         static_cast<unsigned long long>(updates), elapsed, updates / elapsed);
+  printf("wire %.2f MB/s, tiles %.2f MB/s uncompressed, ratio %.1f:1\n", wire / elapsed / 1e6, raw / elapsed / 1e6,
+         wire > 0 ? raw / wire : 0.0);
+  printf("read+decode %.3f ms per update\n",
+         updates > 0 ? std::chrono::duration<double, std::milli>(decode).count() / updates : 0.0);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <socket> [view | bench [seconds]]" << std::endl;
+    return 2;
+  }
+  cfw::StreamReader reader(argv[1]);
+  if (!reader.ok()) {
+    return 1;
+  }
+  const std::string mode = argc > 2 ? argv[2] : "view";
+  if (mode == "bench") {
+    return bench(reader, argc > 3 ? std::atof(argv[3]) : 5.0);
+  }
+  return view(reader);
+}
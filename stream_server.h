@@ -0,0 +1,639 @@
+#ifndef CFW_STREAM_SERVER_H
+#define CFW_STREAM_SERVER_H
+
+#include "formats.h"
+#include "framebuffer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cfw {
+
+// Stream layout, integers little endian. Once per connection:
+//   "CFWS" magic, u8 version, u8 tile size, u8 flags (bit 0 big endian image, bit 1 BGR), u8 0
+// then one update per presented frame that changed something a client has not received yet:
+//   u32 width, u32 height, u32 sequence, u32 tile count, then per tile:
+//   u16 column, u16 row, u32 payload bytes, payload
+// Payloads are the tile's pixels, clipped to the image, row-major with the 4 bytes of each pixel
+// as the image holds them (the hello flags say which), run-length encoded in packets:
+// u8 n < 128 and n + 1 literal pixels, or u8 n >= 128 and one pixel repeated n - 126 times.
+// After a size change every tile is sent.
+namespace stream {
+constexpr char kMagic[4] = {'C', 'F', 'W', 'S'};
+constexpr uint8_t kVersion = 1;
+constexpr int kTileSize = 64;
+constexpr size_t kHelloBytes = 8;
+constexpr size_t kUpdateBytes = 16;
+constexpr size_t kTileBytes = 8;
+
+inline void put16(std::vector<uint8_t>& out, const uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v));
+    out.push_back(static_cast<uint8_t>(v >> 8U));
+}
+
+inline void put32(std::vector<uint8_t>& out, const uint32_t v) {
+    put16(out, v);
+    put16(out, v >> 16U);
+}
+
+inline uint32_t get16(const uint8_t* p) { return p[0] | static_cast<uint32_t>(p[1]) << 8U; }
+inline uint32_t get32(const uint8_t* p) { return get16(p) | get16(p + 2) << 16U; }
+
+inline void putPixels(std::vector<uint8_t>& out, const uint32_t* pixels, const size_t count) {
+    const size_t at = out.size();
+    out.resize(at + count * 4);
+    std::memcpy(out.data() + at, pixels, count * 4);
+}
+
+// Run-length encode count pixels, see the layout above.
+inline void encodeRle(const uint32_t* px, const size_t count, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < 129 && px[i + run] == px[i]) {
+            ++run;
+        }
+        if (run >= 2) {
+            out.push_back(static_cast<uint8_t>(126 + run));
+            putPixels(out, px + i, 1);
+            i += run;
+            continue;
+        }
+        size_t literal = 1;  // up to the next pair of equal pixels
+        while (i + literal < count && literal < 128 &&
+               !(i + literal + 1 < count && px[i + literal] == px[i + literal + 1])) {
+            ++literal;
+        }
+        out.push_back(static_cast<uint8_t>(literal - 1));
+        putPixels(out, px + i, literal);
+        i += literal;
+    }
+}
+
+// Decode count pixels, false if the payload is too short or too long.
+inline bool decodeRle(const uint8_t* in, const size_t bytes, uint32_t* px, const size_t count) {
+    const uint8_t* const end = in + bytes;
+    size_t i = 0;
+    while (i < count && in < end) {
+        const uint8_t n = *in++;
+        const size_t pixels = n < 128 ? n + 1U : n - 126U;
+        const size_t words = n < 128 ? pixels : 1;
+        if (pixels > count - i || static_cast<size_t>(end - in) < words * 4) {
+            return false;
+        }
+        if (n < 128) {
+            std::memcpy(px + i, in, pixels * 4);
+        } else {
+            uint32_t value;
+            std::memcpy(&value, in, 4);
+            std::fill_n(px + i, pixels, value);
+        }
+        in += words * 4;
+        i += pixels;
+    }
+    return i == count && in == end;
+}
+
+// 64 bit hash of the pixels in a rectangle. Four independent lanes keep the multiplies from
+// serializing; each step is a bijection, so any single changed word changes the hash.
+inline uint64_t hashRect(const Framebuffer& fb, const Rect& r) {
+    constexpr uint64_t kMul = 0x9E3779B97F4A7C15ULL;
+    const auto step = [](const uint64_t h, const uint64_t w) {
+        const uint64_t m = (h ^ w) * kMul;
+        return m << 31U | m >> 33U;
+    };
+    uint64_t h[4] = {1, 2, 3, 4};
+    for (int y = r.y; y < r.y + r.height; ++y) {
+        const uint32_t* const row = fb.row(y) + r.x;
+        int x = 0;
+        for (; x + 8 <= r.width; x += 8) {
+            uint64_t w[4];
+            std::memcpy(w, row + x, sizeof(w));
+            h[0] = step(h[0], w[0]);
+            h[1] = step(h[1], w[1]);
+            h[2] = step(h[2], w[2]);
+            h[3] = step(h[3], w[3]);
+        }
+        for (; x < r.width; ++x) {
+            h[0] = step(h[0], row[x]);
+        }
+    }
+    return h[0] ^ (h[1] << 17U | h[1] >> 47U) ^ (h[2] << 31U | h[2] >> 33U) ^ (h[3] << 47U | h[3] >> 17U);
+}
+}  // namespace stream
+
+// Serves presented frames to local clients over a Unix domain socket, see the layout above and
+// Window::startStreaming(). publish() hashes the damaged tiles, copies only the changed ones into
+// the server's copy of the frame and returns; a server thread copies each client's tiles out
+// under the same lock, a bounded chunk at a time, then encodes and sends without it. A client
+// that has not taken its previous update yet gets no new one: the tiles it misses accumulate and
+// go out together once its socket drains, so a slow client costs one pending update, not a queue.
+class StreamServer {
+    // Tiles taken from the frame for one update, encoded without holding mMutex.
+    struct Staged {
+        int width{0};
+        int height{0};
+        int columns{0};
+        uint32_t sequence{0};
+        std::vector<int> tiles;
+        std::vector<uint32_t> pixels;  // the tiles' pixels back to back
+    };
+
+    // Only the server thread adds or removes clients and touches out and sent; publish() marks
+    // dirty tiles under mMutex.
+    struct Client {
+        int fd;
+        std::vector<uint8_t> out;  // the update being sent
+        size_t sent{0};
+        std::vector<uint8_t> dirty;  // per tile, changed since the client's last update
+        bool hasDirty{false};
+    };
+
+    const std::string mPath;
+    int mListen{-1};
+    int mWake[2]{-1, -1};
+    std::thread mThread;
+    std::atomic<bool> mStopping{false};
+
+    // Written by publish() only.
+    std::vector<uint64_t> mHashes;
+    std::vector<int> mChanged;
+
+    mutable std::mutex mMutex;  // guards everything below
+    std::vector<uint32_t> mFrame;
+    int mWidth{0};
+    int mHeight{0};
+    int mColumns{0};
+    int mRows{0};
+    uint32_t mSequence{0};
+    uint8_t mFlags{0};
+    std::vector<Client> mClients;
+
+    Staged mStaged;  // server thread only
+    static constexpr int kStageTiles = 64;  // tiles copied per hold of mMutex, 1 MiB
+
+    std::atomic<uint64_t> mPublished{0};
+    std::atomic<uint64_t> mTilesChanged{0};
+    std::atomic<uint64_t> mBytesSent{0};
+    std::atomic<uint64_t> mCoalesced{0};
+
+    static Rect tileRect(const int index, const int columns, const int width, const int height) {
+        const Rect tile{index % columns * stream::kTileSize, index / columns * stream::kTileSize, stream::kTileSize,
+                        stream::kTileSize};
+        return tile.intersect({0, 0, width, height});
+    }
+
+    Rect tileRect(const int index) const { return tileRect(index, mColumns, mWidth, mHeight); }
+
+    void markAll(Client& client) const {
+        client.dirty.assign(static_cast<size_t>(mColumns) * mRows, 1);
+        client.hasDirty = mWidth > 0;
+    }
+
+    // Copy the client's dirty tiles out of the frame, false if it has none. The lock is taken
+    // for kStageTiles tiles at a time, so publish() waits for at most one such chunk (1 MiB),
+    // never for a whole frame, encoding or sending. Tiles published between chunks go out in
+    // this update if not yet passed, otherwise in the next; a resize starts over.
+    bool stage(Client& client) {
+        int next = 0;
+        for (;;) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (next > 0 && (mWidth != mStaged.width || mHeight != mStaged.height)) {
+                next = 0;  // resized between chunks, every tile is dirty again
+            }
+            if (next == 0) {
+                if (!client.hasDirty) {
+                    return false;
+                }
+                client.hasDirty = false;
+                mStaged.width = mWidth;
+                mStaged.height = mHeight;
+                mStaged.columns = mColumns;
+                mStaged.tiles.clear();
+                mStaged.pixels.clear();
+            }
+            mStaged.sequence = mSequence;
+            const int count = static_cast<int>(client.dirty.size());
+            for (int copied = 0; next < count && copied < kStageTiles; ++next) {
+                if (client.dirty[next] == 0) {
+                    continue;
+                }
+                client.dirty[next] = 0;
+                const Rect tile = tileRect(next);
+                const size_t at = mStaged.pixels.size();
+                mStaged.pixels.resize(at + static_cast<size_t>(tile.width) * tile.height);
+                for (int y = 0; y < tile.height; ++y) {
+                    std::memcpy(mStaged.pixels.data() + at + static_cast<size_t>(y) * tile.width,
+                                mFrame.data() + static_cast<size_t>(tile.y + y) * mWidth + tile.x,
+                                tile.width * sizeof(uint32_t));
+                }
+                mStaged.tiles.push_back(next);
+                ++copied;
+            }
+            if (next == count) {
+                return !mStaged.tiles.empty();
+            }
+        }
+    }
+
+    // Encode the staged tiles as the client's next update.
+    void encode(Client& client) const {
+        client.out.clear();
+        client.sent = 0;
+        stream::put32(client.out, mStaged.width);
+        stream::put32(client.out, mStaged.height);
+        stream::put32(client.out, mStaged.sequence);
+        stream::put32(client.out, static_cast<uint32_t>(mStaged.tiles.size()));
+        const uint32_t* pixels = mStaged.pixels.data();
+        for (const int i : mStaged.tiles) {
+            const Rect tile = tileRect(i, mStaged.columns, mStaged.width, mStaged.height);
+            const size_t count = static_cast<size_t>(tile.width) * tile.height;
+            stream::put16(client.out, i % mStaged.columns);
+            stream::put16(client.out, i / mStaged.columns);
+            const size_t sizeAt = client.out.size();
+            stream::put32(client.out, 0);
+            stream::encodeRle(pixels, count, client.out);
+            pixels += count;
+            const uint32_t bytes = static_cast<uint32_t>(client.out.size() - sizeAt - 4);
+            for (int b = 0; b < 4; ++b) {
+                client.out[sizeAt + b] = static_cast<uint8_t>(bytes >> (8U * b));
+            }
+        }
+    }
+
+    // Send what the socket takes without blocking, false if the client is gone.
+    bool flush(Client& client) {
+        while (client.sent < client.out.size()) {
+#ifdef MSG_NOSIGNAL
+            const int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+            const int flags = MSG_DONTWAIT;
+#endif
+            const ssize_t n = send(client.fd, client.out.data() + client.sent, client.out.size() - client.sent, flags);
+            if (n < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            client.sent += static_cast<size_t>(n);
+            mBytesSent += static_cast<uint64_t>(n);
+        }
+        client.out.clear();
+        client.sent = 0;
+        return true;
+    }
+
+    void accept() {
+        for (;;) {
+            const int fd = ::accept(mListen, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+            const int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            std::lock_guard<std::mutex> lock(mMutex);
+            Client client{fd, {}, 0, {}, false};
+            client.out.assign(stream::kMagic, stream::kMagic + 4);
+            client.out.push_back(stream::kVersion);
+            client.out.push_back(stream::kTileSize);
+            client.out.push_back(mFlags);
+            client.out.push_back(0);
+            markAll(client);
+            mClients.push_back(std::move(client));
+        }
+    }
+
+    void serverThread() {
+        std::vector<pollfd> fds;
+        while (!mStopping) {
+            fds.clear();
+            fds.push_back({mListen, POLLIN, 0});
+            fds.push_back({mWake[0], POLLIN, 0});
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                for (const Client& client : mClients) {
+                    const bool pending = client.sent < client.out.size();
+                    fds.push_back({client.fd, static_cast<short>(POLLIN | (pending ? POLLOUT : 0)), 0});
+                }
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+                break;
+            }
+            if ((fds[1].revents & POLLIN) != 0) {
+                char drain[64];
+                while (read(mWake[0], drain, sizeof(drain)) > 0) {
+                }
+            }
+
+            if ((fds[0].revents & POLLIN) != 0) {
+                accept();  // the hello goes out with the next poll
+            }
+
+            // f follows the client's pollfd, erased clients included; ones accepted above have none.
+            for (size_t i = 0, f = 2; i < mClients.size(); ++f) {
+                Client& client = mClients[i];
+                bool alive = true;
+                // Clients send nothing; readable means closed.
+                if (f < fds.size() && (fds[f].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                    char drain[64];
+                    const ssize_t n = recv(client.fd, drain, sizeof(drain), MSG_DONTWAIT);
+                    alive = n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+                }
+                alive = alive && flush(client);
+                if (alive && client.out.empty() && stage(client)) {
+                    encode(client);
+                    alive = flush(client);
+                }
+                if (!alive) {
+                    close(client.fd);
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mClients.erase(mClients.begin() + static_cast<ptrdiff_t>(i));
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+public:
+    explicit StreamServer(const std::string& path) : mPath(path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Stream socket path is empty or too long: " << path << "." << std::endl;
+            return;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        struct stat st {};
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path.c_str());  // left behind by a previous run
+        }
+        mListen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (mListen < 0 || bind(mListen, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(mListen, 8) != 0 || pipe(mWake) != 0) {
+            std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << "." << std::endl;
+            return;
+        }
+        for (const int fd : {mListen, mWake[0], mWake[1]}) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        mThread = std::thread(&StreamServer::serverThread, this);
+    }
+
+    ~StreamServer() {
+        if (mThread.joinable()) {
+            mStopping = true;
+            const char wake = 0;
+            (void)!write(mWake[1], &wake, 1);
+            mThread.join();
+        }
+        for (const Client& client : mClients) {
+            close(client.fd);
+        }
+        for (const int fd : {mListen, mWake[0], mWake[1]}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        if (mListen >= 0) {
+            unlink(mPath.c_str());
+        }
+    }
+
+    StreamServer(const StreamServer&) = delete;
+    StreamServer(StreamServer&&) = delete;
+    void operator=(const StreamServer&) = delete;
+    void operator=(StreamServer&&) = delete;
+
+    bool ok() const { return mThread.joinable(); }
+
+    // Offer the presented frame; only tiles overlapping damage are hashed. Call from one thread.
+    void publish(const Framebuffer& fb, const Rect& damage, const VisualFormat& visual) {
+        if (!ok() || fb.pixels == nullptr) {
+            return;
+        }
+        const int columns = (fb.width + stream::kTileSize - 1) / stream::kTileSize;
+        const int rows = (fb.height + stream::kTileSize - 1) / stream::kTileSize;
+        const bool resized = fb.width != mWidth || fb.height != mHeight;
+        if (resized) {
+            mHashes.assign(static_cast<size_t>(columns) * rows, 0);
+        }
+        const Rect area = resized ? Rect{0, 0, fb.width, fb.height} : damage.intersect({0, 0, fb.width, fb.height});
+        mChanged.clear();
+        if (!area.empty()) {
+            for (int ty = area.y / stream::kTileSize; ty <= (area.y + area.height - 1) / stream::kTileSize; ++ty) {
+                for (int tx = area.x / stream::kTileSize; tx <= (area.x + area.width - 1) / stream::kTileSize; ++tx) {
+                    const Rect tile = Rect{tx * stream::kTileSize, ty * stream::kTileSize, stream::kTileSize,
+                                           stream::kTileSize}.intersect({0, 0, fb.width, fb.height});
+                    const uint64_t hash = stream::hashRect(fb, tile);
+                    const int index = ty * columns + tx;
+                    if (resized || hash != mHashes[index]) {
+                        mHashes[index] = hash;
+                        mChanged.push_back(index);
+                    }
+                }
+            }
+        }
+        ++mPublished;
+        if (mChanged.empty()) {
+            return;
+        }
+        mTilesChanged += mChanged.size();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (resized) {
+                mWidth = fb.width;
+                mHeight = fb.height;
+                mColumns = columns;
+                mRows = rows;
+                mFrame.assign(static_cast<size_t>(mWidth) * mHeight, 0);
+            }
+            mFlags = static_cast<uint8_t>((visual.bigEndian ? 1U : 0U) | (visual.bgr ? 2U : 0U));
+            ++mSequence;
+            for (const int index : mChanged) {
+                const Rect tile = tileRect(index);
+                for (int y = tile.y; y < tile.y + tile.height; ++y) {
+                    std::memcpy(mFrame.data() + static_cast<size_t>(y) * mWidth + tile.x, fb.row(y) + tile.x,
+                                tile.width * sizeof(uint32_t));
+                }
+            }
+            for (Client& client : mClients) {
+                if (client.hasDirty) {
+                    ++mCoalesced;  // still sending an earlier update, this frame merges into its next
+                }
+                if (resized) {
+                    markAll(client);
+                } else {
+                    for (const int index : mChanged) {
+                        client.dirty[index] = 1;
+                    }
+                    client.hasDirty = true;
+                }
+            }
+        }
+        const char wake = 0;
+        (void)!write(mWake[1], &wake, 1);
+    }
+
+    size_t clients() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mClients.size();
+    }
+
+    uint64_t published() const { return mPublished; }
+    uint64_t tilesChanged() const { return mTilesChanged; }
+    uint64_t bytesSent() const { return mBytesSent; }
+    // Client updates merged into a later one because the client had not caught up.
+    uint64_t coalesced() const { return mCoalesced; }
+};
+
+// Client side: connects to a StreamServer and applies its updates to a full copy of the image.
+class StreamReader {
+    int mFd{-1};
+    VisualFormat mVisual;
+    std::vector<uint32_t> mImage;
+    int mWidth{0};
+    int mHeight{0};
+    uint32_t mSequence{0};
+    std::vector<uint8_t> mPayload;
+    std::vector<uint32_t> mTile;
+    uint64_t mWireBytes{0};
+    uint64_t mRawBytes{0};
+
+    bool readExact(uint8_t* out, size_t size) {
+        while (size > 0) {
+            const ssize_t n = recv(mFd, out, size, 0);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            out += n;
+            size -= static_cast<size_t>(n);
+            mWireBytes += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+public:
+    explicit StreamReader(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Stream socket path is too long: " << path << "." << std::endl;
+            return;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        mFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        uint8_t hello[stream::kHelloBytes];
+        if (mFd < 0 || connect(mFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            !readExact(hello, sizeof(hello)) || std::memcmp(hello, stream::kMagic, 4) != 0 ||
+            hello[4] != stream::kVersion || hello[5] != stream::kTileSize) {
+            std::cerr << "Failed to connect to a cfw stream at " << path << "." << std::endl;
+            if (mFd >= 0) {
+                close(mFd);
+                mFd = -1;
+            }
+            return;
+        }
+        mVisual.bigEndian = (hello[6] & 1U) != 0;
+        mVisual.bgr = (hello[6] & 2U) != 0;
+    }
+
+    ~StreamReader() {
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    StreamReader(const StreamReader&) = delete;
+    void operator=(const StreamReader&) = delete;
+
+    bool ok() const { return mFd >= 0; }
+    int fd() const { return mFd; }
+
+    // Block for the next update and apply it; damage receives the union of its tiles. False when
+    // the server is gone or the stream is malformed.
+    bool read(Rect* damage = nullptr) {
+        uint8_t header[stream::kUpdateBytes];
+        if (mFd < 0 || !readExact(header, sizeof(header))) {
+            return false;
+        }
+        const int width = static_cast<int>(stream::get32(header));
+        const int height = static_cast<int>(stream::get32(header + 4));
+        mSequence = stream::get32(header + 8);
+        const uint32_t tiles = stream::get32(header + 12);
+        if (width <= 0 || height <= 0 || width > (1 << 16) || height > (1 << 16)) {
+            return false;
+        }
+        if (width != mWidth || height != mHeight) {
+            mWidth = width;
+            mHeight = height;
+            mImage.assign(static_cast<size_t>(width) * height, 0);
+        }
+        Rect changed;
+        mTile.resize(stream::kTileSize * stream::kTileSize);
+        for (uint32_t t = 0; t < tiles; ++t) {
+            uint8_t tileHeader[stream::kTileBytes];
+            if (!readExact(tileHeader, sizeof(tileHeader))) {
+                return false;
+            }
+            const Rect tile = Rect{static_cast<int>(stream::get16(tileHeader)) * stream::kTileSize,
+                                   static_cast<int>(stream::get16(tileHeader + 2)) * stream::kTileSize,
+                                   stream::kTileSize, stream::kTileSize}.intersect({0, 0, mWidth, mHeight});
+            const uint32_t bytes = stream::get32(tileHeader + 4);
+            if (tile.empty() || bytes > stream::kTileSize * stream::kTileSize * 5U) {
+                return false;
+            }
+            mPayload.resize(bytes);
+            const size_t count = static_cast<size_t>(tile.width) * tile.height;
+            if (!readExact(mPayload.data(), bytes) || !stream::decodeRle(mPayload.data(), bytes, mTile.data(), count)) {
+                return false;
+            }
+            for (int y = 0; y < tile.height; ++y) {
+                std::memcpy(mImage.data() + static_cast<size_t>(tile.y + y) * mWidth + tile.x,
+                            mTile.data() + static_cast<size_t>(y) * tile.width, tile.width * sizeof(uint32_t));
+            }
+            mRawBytes += count * 4;
+            changed = changed.unite(tile);
+        }
+        if (damage != nullptr) {
+            *damage = changed;
+        }
+        return true;
+    }
+
+    // The image, width() words per row, in the server's byte order, see visual().
+    const uint32_t* pixels() const { return mImage.data(); }
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    VisualFormat visual() const { return mVisual; }
+    uint32_t sequence() const { return mSequence; }
+
+    // Bytes received, and what the updated tiles would have been uncompressed.
+    uint64_t wireBytes() const { return mWireBytes; }
+    uint64_t rawBytes() const { return mRawBytes; }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_STREAM_SERVER_H
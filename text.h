@@ -0,0 +1,302 @@
+#ifndef CFW_TEXT_H
+#define CFW_TEXT_H
+
+#include "framebuffer.h"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cfw {
+
+namespace font8x16 {
+constexpr int kWidth = 8;
+constexpr int kHeight = 16;
+constexpr uint32_t kFirst = 32;
+constexpr uint32_t kCount = 95;
+
+// Printable ASCII rasterized from DejaVu Sans Mono, one byte per row, MSB is the leftmost pixel.
+constexpr uint8_t kBits[kCount][kHeight] = {
+    // clang-format off
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // space
+    0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // !
+    0x00, 0x00, 0x00, 0x2c, 0x2c, 0x2c, 0x2c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // "
+    0x00, 0x00, 0x12, 0x16, 0x14, 0x7f, 0x24, 0x2c, 0xfe, 0x68, 0x48, 0x48, 0x00, 0x00, 0x00, 0x00,  // #
+    0x00, 0x00, 0x00, 0x08, 0x3c, 0x6a, 0x68, 0x38, 0x1e, 0x0a, 0x4e, 0x3c, 0x08, 0x08, 0x00, 0x00,  // $
+    0x00, 0x00, 0x00, 0x70, 0x90, 0x90, 0x76, 0x18, 0x6e, 0x0b, 0x0b, 0x0e, 0x00, 0x00, 0x00, 0x00,  // %
+    0x00, 0x00, 0x00, 0x3c, 0x60, 0x20, 0x30, 0x5b, 0xcb, 0xc6, 0x46, 0x3b, 0x00, 0x00, 0x00, 0x00,  // &
+    0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '
+    0x00, 0x08, 0x08, 0x18, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x18, 0x08, 0x08, 0x00, 0x00, 0x00,  // (
+    0x00, 0x30, 0x10, 0x18, 0x18, 0x08, 0x08, 0x08, 0x08, 0x18, 0x18, 0x10, 0x30, 0x00, 0x00, 0x00,  // )
+    0x00, 0x00, 0x00, 0x10, 0x56, 0x3c, 0x3c, 0x56, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // *
+    0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0xfe, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,  // +
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x10, 0x10, 0x00, 0x00,  // ,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // -
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // .
+    0x00, 0x00, 0x00, 0x06, 0x04, 0x0c, 0x08, 0x18, 0x10, 0x10, 0x30, 0x20, 0x60, 0x40, 0x00, 0x00,  // /
+    0x00, 0x00, 0x00, 0x3c, 0x64, 0x46, 0x42, 0x5a, 0x42, 0x46, 0x64, 0x3c, 0x00, 0x00, 0x00, 0x00,  // 0
+    0x00, 0x00, 0x00, 0x78, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x3e, 0x00, 0x00, 0x00, 0x00,  // 1
+    0x00, 0x00, 0x00, 0x3c, 0x44, 0x06, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x7e, 0x00, 0x00, 0x00, 0x00,  // 2
+    0x00, 0x00, 0x00, 0x3c, 0x44, 0x06, 0x04, 0x3c, 0x06, 0x06, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00,  // 3
+    0x00, 0x00, 0x00, 0x0c, 0x1c, 0x14, 0x24, 0x64, 0x44, 0x7e, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00,  // 4
+    0x00, 0x00, 0x00, 0x7c, 0x60, 0x60, 0x7c, 0x04, 0x06, 0x06, 0x44, 0x7c, 0x00, 0x00, 0x00, 0x00,  // 5
+    0x00, 0x00, 0x00, 0x3c, 0x60, 0x40, 0x7c, 0x66, 0x42, 0x42, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00,  // 6
+    0x00, 0x00, 0x00, 0x7e, 0x06, 0x04, 0x0c, 0x08, 0x18, 0x18, 0x10, 0x30, 0x00, 0x00, 0x00, 0x00,  // 7
+    0x00, 0x00, 0x00, 0x3c, 0x66, 0x46, 0x66, 0x3c, 0x66, 0x42, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00,  // 8
+    0x00, 0x00, 0x00, 0x3c, 0x64, 0x46, 0x46, 0x66, 0x3e, 0x06, 0x04, 0x38, 0x00, 0x00, 0x00, 0x00,  // 9
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // :
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x10, 0x10, 0x00, 0x00,  // ;
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x1c, 0x70, 0x70, 0x1c, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,  // <
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // =
+    0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x78, 0x0e, 0x0e, 0x78, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00,  // >
+    0x00, 0x00, 0x00, 0x3c, 0x26, 0x06, 0x0c, 0x18, 0x10, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00,  // ?
+    0x00, 0x00, 0x00, 0x3c, 0x62, 0x42, 0xdf, 0x93, 0x93, 0x93, 0xdf, 0x40, 0x60, 0x1c, 0x00, 0x00,  // @
+    0x00, 0x00, 0x00, 0x18, 0x18, 0x3c, 0x2c, 0x24, 0x66, 0x7e, 0x42, 0xc3, 0x00, 0x00, 0x00, 0x00,  // A
+    0x00, 0x00, 0x00, 0x7c, 0x46, 0x46, 0x46, 0x7c, 0x46, 0x42, 0x46, 0x7c, 0x00, 0x00, 0x00, 0x00,  // B
+    0x00, 0x00, 0x00, 0x1c, 0x22, 0x60, 0x40, 0x40, 0x40, 0x60, 0x22, 0x1c, 0x00, 0x00, 0x00, 0x00,  // C
+    0x00, 0x00, 0x00, 0x78, 0x4c, 0x46, 0x46, 0x42, 0x46, 0x46, 0x4c, 0x78, 0x00, 0x00, 0x00, 0x00,  // D
+    0x00, 0x00, 0x00, 0x7e, 0x60, 0x60, 0x60, 0x7e, 0x60, 0x60, 0x60, 0x7e, 0x00, 0x00, 0x00, 0x00,  // E
+    0x00, 0x00, 0x00, 0x7e, 0x60, 0x60, 0x60, 0x7e, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00,  // F
+    0x00, 0x00, 0x00, 0x3c, 0x62, 0x40, 0x40, 0x4e, 0x42, 0x42, 0x62, 0x3c, 0x00, 0x00, 0x00, 0x00,  // G
+    0x00, 0x00, 0x00, 0x42, 0x42, 0x42, 0x42, 0x7e, 0x42, 0x42, 0x42, 0x42, 0x00, 0x00, 0x00, 0x00,  // H
+    0x00, 0x00, 0x00, 0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00, 0x00, 0x00, 0x00,  // I
+    0x00, 0x00, 0x00, 0x3c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x4c, 0x78, 0x00, 0x00, 0x00, 0x00,  // J
+    0x00, 0x00, 0x00, 0x42, 0x44, 0x48, 0x70, 0x78, 0x48, 0x4c, 0x46, 0x43, 0x00, 0x00, 0x00, 0x00,  // K
+    0x00, 0x00, 0x00, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7e, 0x00, 0x00, 0x00, 0x00,  // L
+    0x00, 0x00, 0x00, 0xe6, 0xe6, 0xe6, 0xfa, 0xda, 0xda, 0xc2, 0xc2, 0xc2, 0x00, 0x00, 0x00, 0x00,  // M
+    0x00, 0x00, 0x00, 0x62, 0x62, 0x72, 0x52, 0x5a, 0x4a, 0x4e, 0x46, 0x46, 0x00, 0x00, 0x00, 0x00,  // N
+    0x00, 0x00, 0x00, 0x3c, 0x66, 0x46, 0x42, 0x42, 0x42, 0x46, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00,  // O
+    0x00, 0x00, 0x00, 0x7c, 0x66, 0x62, 0x62, 0x66, 0x7c, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00,  // P
+    0x00, 0x00, 0x00, 0x3c, 0x66, 0x46, 0x42, 0x42, 0x42, 0x46, 0x66, 0x3c, 0x0c, 0x04, 0x00, 0x00,  // Q
+    0x00, 0x00, 0x00, 0x7c, 0x46, 0x46, 0x46, 0x7c, 0x4c, 0x46, 0x42, 0x43, 0x00, 0x00, 0x00, 0x00,  // R
+    0x00, 0x00, 0x00, 0x3c, 0x64, 0x40, 0x60, 0x3c, 0x06, 0x02, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00,  // S
+    0x00, 0x00, 0x00, 0xff, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // T
+    0x00, 0x00, 0x00, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00,  // U
+    0x00, 0x00, 0x00, 0xc2, 0x42, 0x46, 0x64, 0x24, 0x2c, 0x3c, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // V
+    0x00, 0x00, 0x00, 0x83, 0xc3, 0xc3, 0xda, 0x5a, 0x5a, 0x6e, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00,  // W
+    0x00, 0x00, 0x00, 0x42, 0x66, 0x3c, 0x18, 0x18, 0x3c, 0x24, 0x66, 0xc2, 0x00, 0x00, 0x00, 0x00,  // X
+    0x00, 0x00, 0x00, 0xc2, 0x66, 0x24, 0x3c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // Y
+    0x00, 0x00, 0x00, 0x7e, 0x06, 0x04, 0x0c, 0x18, 0x10, 0x20, 0x60, 0x7f, 0x00, 0x00, 0x00, 0x00,  // Z
+    0x00, 0x1c, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1c, 0x00, 0x00, 0x00,  // [
+    0x00, 0x00, 0x00, 0x40, 0x60, 0x20, 0x30, 0x10, 0x10, 0x18, 0x08, 0x0c, 0x04, 0x06, 0x00, 0x00,  // backslash
+    0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x38, 0x00, 0x00, 0x00,  // ]
+    0x00, 0x00, 0x00, 0x18, 0x3c, 0x64, 0x42, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // ^
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x00,  // _
+    0x00, 0x00, 0x30, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // `
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x46, 0x06, 0x3e, 0x46, 0x46, 0x7e, 0x00, 0x00, 0x00, 0x00,  // a
+    0x00, 0x60, 0x60, 0x60, 0x60, 0x7c, 0x66, 0x62, 0x62, 0x62, 0x66, 0x7c, 0x00, 0x00, 0x00, 0x00,  // b
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x1c, 0x22, 0x60, 0x60, 0x60, 0x22, 0x1c, 0x00, 0x00, 0x00, 0x00,  // c
+    0x00, 0x06, 0x06, 0x06, 0x06, 0x3e, 0x66, 0x46, 0x46, 0x46, 0x66, 0x3e, 0x00, 0x00, 0x00, 0x00,  // d
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x66, 0x42, 0x7e, 0x40, 0x62, 0x3c, 0x00, 0x00, 0x00, 0x00,  // e
+    0x00, 0x0e, 0x18, 0x10, 0x10, 0x7e, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00,  // f
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x66, 0x46, 0x46, 0x46, 0x66, 0x3e, 0x06, 0x04, 0x38, 0x00,  // g
+    0x00, 0x60, 0x60, 0x60, 0x60, 0x7c, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00,  // h
+    0x00, 0x18, 0x00, 0x00, 0x00, 0x38, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00, 0x00, 0x00, 0x00,  // i
+    0x00, 0x08, 0x00, 0x00, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x18, 0x70, 0x00,  // j
+    0x00, 0x60, 0x60, 0x60, 0x60, 0x66, 0x6c, 0x78, 0x78, 0x6c, 0x66, 0x62, 0x00, 0x00, 0x00, 0x00,  // k
+    0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x18, 0x0e, 0x00, 0x00, 0x00, 0x00,  // l
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x00, 0x00, 0x00, 0x00,  // m
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00,  // n
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x66, 0x46, 0x42, 0x46, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00,  // o
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0x66, 0x62, 0x62, 0x62, 0x66, 0x7c, 0x40, 0x40, 0x40, 0x00,  // p
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x66, 0x46, 0x46, 0x46, 0x66, 0x3e, 0x06, 0x06, 0x06, 0x00,  // q
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00,  // r
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x64, 0x60, 0x3c, 0x06, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00,  // s
+    0x00, 0x00, 0x00, 0x10, 0x10, 0x7e, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1e, 0x00, 0x00, 0x00, 0x00,  // t
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3e, 0x00, 0x00, 0x00, 0x00,  // u
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x46, 0x64, 0x24, 0x3c, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00,  // v
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x83, 0xc3, 0xda, 0x5a, 0x7e, 0x6e, 0x64, 0x00, 0x00, 0x00, 0x00,  // w
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x24, 0x18, 0x18, 0x3c, 0x24, 0x42, 0x00, 0x00, 0x00, 0x00,  // x
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x66, 0x24, 0x24, 0x3c, 0x18, 0x18, 0x18, 0x10, 0x70, 0x00,  // y
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x04, 0x0c, 0x18, 0x30, 0x20, 0x7e, 0x00, 0x00, 0x00, 0x00,  // z
+    0x00, 0x0e, 0x18, 0x18, 0x18, 0x18, 0x70, 0x10, 0x18, 0x18, 0x18, 0x18, 0x0e, 0x00, 0x00, 0x00,  // {
+    0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,  // |
+    0x00, 0x70, 0x10, 0x18, 0x18, 0x18, 0x0e, 0x18, 0x18, 0x18, 0x18, 0x10, 0x70, 0x00, 0x00, 0x00,  // }
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x72, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // ~
+    // clang-format on
+};
+}  // namespace font8x16
+
+// Glyph bitmaps expanded once into select masks (0 or ~0 per pixel), so drawing a
+// glyph row is a branch-free (dst & ~mask) | (color & mask) over a few words.
+class GlyphAtlas {
+    std::vector<uint32_t> mMasks;  // glyph g, row y starts at (g * mCellHeight + y) * mCellWidth
+    int mCellWidth;
+    int mCellHeight;
+
+public:
+    explicit GlyphAtlas(const int scale = 1)
+        : mCellWidth(font8x16::kWidth * scale), mCellHeight(font8x16::kHeight * scale) {
+        assert(scale > 0);
+        mMasks.resize(static_cast<size_t>(font8x16::kCount) * mCellWidth * mCellHeight);
+        uint32_t* out = mMasks.data();
+        for (uint32_t g = 0; g < font8x16::kCount; ++g) {
+            for (int y = 0; y < mCellHeight; ++y) {
+                const uint8_t bits = font8x16::kBits[g][y / scale];
+                for (int x = 0; x < mCellWidth; ++x) {
+                    *out++ = ((bits << (x / scale)) & 0x80U) != 0 ? 0xffffffffU : 0U;
+                }
+            }
+        }
+    }
+
+    static const GlyphAtlas& builtin() {
+        static const GlyphAtlas atlas;
+        return atlas;
+    }
+
+    int cellWidth() const { return mCellWidth; }
+    int cellHeight() const { return mCellHeight; }
+
+    static uint16_t glyphIndex(const uint32_t codepoint) {
+        if (codepoint < font8x16::kFirst || codepoint >= font8x16::kFirst + font8x16::kCount) {
+            return static_cast<uint16_t>('?' - font8x16::kFirst);
+        }
+        return static_cast<uint16_t>(codepoint - font8x16::kFirst);
+    }
+
+    const uint32_t* glyphRow(const uint16_t glyph, const int y) const {
+        return mMasks.data() + (static_cast<size_t>(glyph) * mCellHeight + y) * mCellWidth;
+    }
+};
+
+// Draws monospaced text from a GlyphAtlas into a framebuffer. Layouts of strings that
+// are drawn repeatedly (labels, counters with stable text) are cached.
+class TextRenderer {
+public:
+    static constexpr uint16_t kNewline = 0xffff;
+
+    struct Layout {
+        std::vector<uint16_t> glyphs;  // glyph indices, kNewline between lines
+        int columns{0};
+        int lines{0};
+    };
+
+private:
+    static constexpr size_t kMaxCachedLayouts = 256;
+
+    const GlyphAtlas& mAtlas;
+    std::unordered_map<std::string, Layout> mCache;
+    std::vector<Rect> mDamage;
+
+    static Layout layoutOf(const std::string& text) {
+        Layout layout;
+        layout.glyphs.reserve(text.size());
+        layout.lines = 1;
+        int column = 0;
+        for (size_t i = 0; i < text.size();) {
+            // Decode UTF-8, anything outside the atlas becomes '?'.
+            uint32_t cp = static_cast<unsigned char>(text[i]);
+            const int extra = cp < 0x80U ? 0 : cp < 0xe0U ? 1 : cp < 0xf0U ? 2 : 3;
+            cp &= extra == 0 ? 0x7fU : 0x3fU >> extra;
+            for (int k = 1; k <= extra && i + k < text.size(); ++k) {
+                cp = (cp << 6U) | (static_cast<unsigned char>(text[i + k]) & 0x3fU);
+            }
+            i += extra + 1;
+
+            if (cp == '\n') {
+                layout.glyphs.push_back(kNewline);
+                ++layout.lines;
+                column = 0;
+                continue;
+            }
+            layout.glyphs.push_back(GlyphAtlas::glyphIndex(cp));
+            layout.columns = std::max(layout.columns, ++column);
+        }
+        return layout;
+    }
+
+    template <bool kOpaque>
+    void drawLayout(const Framebuffer& fb, const int x, const int y, const Layout& layout, const uint32_t color,
+                    const uint32_t background) const {
+        const int cw = mAtlas.cellWidth();
+        const int ch = mAtlas.cellHeight();
+        const Rect bounds = fb.bounds();
+        int penX = x;
+        int penY = y;
+        for (const uint16_t glyph : layout.glyphs) {
+            if (glyph == kNewline) {
+                penX = x;
+                penY += ch;
+                continue;
+            }
+            const Rect cell = Rect{penX, penY, cw, ch}.intersect(bounds);
+            if (!cell.empty()) {
+                const int gx0 = cell.x - penX;
+                for (int row = cell.y; row < cell.y + cell.height; ++row) {
+                    const uint32_t* mask = mAtlas.glyphRow(glyph, row - penY) + gx0;
+                    uint32_t* dst = fb.row(row) + cell.x;
+                    // Fixed-width inner loop, compilers vectorize the full-cell case.
+                    for (int i = 0; i < cell.width; ++i) {
+                        const uint32_t base = kOpaque ? background : dst[i];
+                        dst[i] = (base & ~mask[i]) | (color & mask[i]);
+                    }
+                }
+            }
+            penX += cw;
+        }
+    }
+
+    Rect drawImpl(const Framebuffer& fb, const int x, const int y, const std::string& text, uint32_t color,
+                  uint32_t background, const bool opaque) {
+        auto iter = mCache.find(text);
+        if (iter == mCache.end()) {
+            if (mCache.size() >= kMaxCachedLayouts) {
+                mCache.clear();
+            }
+            iter = mCache.emplace(text, layoutOf(text)).first;
+        }
+        const Layout& layout = iter->second;
+        color = fb.pixel(color);
+        background = fb.pixel(background);
+        const Rect area =
+            Rect{x, y, layout.columns * mAtlas.cellWidth(), layout.lines * mAtlas.cellHeight()}.intersect(fb.bounds());
+        if (area.empty()) {
+            return area;
+        }
+        if (opaque) {
+            // Fill the whole box first so ragged lines do not leave stale pixels behind.
+            for (int row = area.y; row < area.y + area.height; ++row) {
+                std::fill_n(fb.row(row) + area.x, area.width, background);
+            }
+            drawLayout<true>(fb, x, y, layout, color, background);
+        } else {
+            drawLayout<false>(fb, x, y, layout, color, background);
+        }
+        mDamage.push_back(area);
+        return area;
+    }
+
+public:
+    explicit TextRenderer(const GlyphAtlas& atlas = GlyphAtlas::builtin()) : mAtlas(atlas) {}
+
+    // Size of the text box, at origin 0, 0.
+    Rect measure(const std::string& text) const {
+        const Layout layout = layoutOf(text);
+        return {0, 0, layout.columns * mAtlas.cellWidth(), layout.lines * mAtlas.cellHeight()};
+    }
+
+    // Draw text with transparent background. Colors are native 0x00RRGGBB, converted to fb's layout.
+    Rect draw(const Framebuffer& fb, const int x, const int y, const std::string& text, const uint32_t color) {
+        return drawImpl(fb, x, y, text, color, 0, false);
+    }
+
+    // Draw text on a solid box.
+    Rect draw(const Framebuffer& fb, const int x, const int y, const std::string& text, const uint32_t color,
+              const uint32_t background) {
+        return drawImpl(fb, x, y, text, color, background, true);
+    }
+
+    // Rectangles touched since the last call, suitable for Window::paint(const Rect&).
+    std::vector<Rect> takeDamage() {
+        std::vector<Rect> damage;
+        damage.swap(mDamage);
+        return damage;
+    }
+};
+
+}  // namespace cfw
+
+#endif  // CFW_TEXT_H
@@ -35,6 +35,15 @@ inline void sleep(const unsigned int milliseconds) {
 }
 
 
+// Every Win32 window already has its own thread and message queue, so contexts carry nothing.
+class DisplayContext {
+public:
+    static const std::shared_ptr<DisplayContext>& shared() {
+        static const std::shared_ptr<DisplayContext> context = std::make_shared<DisplayContext>();
+        return context;
+    }
+};
+
 class Win32 : public WindowBase {
 
     bool mMouseIsTracked{};
@@ -46,9 +55,28 @@ class Win32 : public WindowBase {
     uint32_t* mPixels{};  // TODO: Don't use raw allocation
     BITMAPINFO mBitmapInfo{};
     HDC mDeviceContextHandle{};
+    PackedPalette mPackedPalette;
 
     static LRESULT APIENTRY handleEvents(HWND window, UINT msg, WPARAM wParam, LPARAM lParam) {
         auto* const disp = reinterpret_cast<Win32*>(GetWindowLongPtr(window, GWLP_USERDATA));
+        disp->mHud.event();
+        switch (msg) {
+            case WM_CLOSE:
+            case WM_KEYDOWN:
+            case WM_KEYUP:
+            case WM_MOUSEMOVE:
+            case WM_LBUTTONDOWN:
+            case WM_RBUTTONDOWN:
+            case WM_MBUTTONDOWN:
+            case WM_LBUTTONUP:
+            case WM_RBUTTONUP:
+            case WM_MBUTTONUP:
+            case WM_MOUSEWHEEL:
+                disp->stampInput(static_cast<uint32_t>(GetMessageTime()));
+                break;
+            default:
+                break;
+        }
 
         // TODO: Create function in Display class to handle event. Improve
         // encapsulation.
@@ -217,6 +245,7 @@ class Win32 : public WindowBase {
     void destructImpl() {
         DestroyWindow(mWindowHandle);
         TerminateThread(mmEventThreadHandle, 0);
+        detachSnapshot();
         delete[] mPixels;
         delete[] mWindowTitle;
         mPixels = nullptr;
@@ -265,11 +294,9 @@ class Win32 : public WindowBase {
     }
 
     void setKey(const unsigned int keycode, const bool isPressed = true) {
-      if (mKeyboardCallback) {
-        for (int i = 0; i < static_cast<int>(Keys::NUM_KEYS); ++i) {
-          if (keyCodes[i] == keycode) {
-            mKeyboardCallback(static_cast<Keys>(i), isPressed);
-          }
+      for (int i = 0; i < static_cast<int>(Keys::NUM_KEYS); ++i) {
+        if (keyCodes[i] == keycode) {
+          dispatchKeyCallback(static_cast<Keys>(i), isPressed);
         }
       }
     }
@@ -279,10 +306,41 @@ public:  // WINDOWS
         : WindowBase(width, height, title) {
         constructImpl(width, height, title);
     }
+
+    // Creation already completes on the window's own thread, so async is not needed here and
+    // onReady runs before the constructor returns.
+    Win32(const unsigned int width, const unsigned int height, const char* const title, const WindowOptions& options)
+        : WindowBase(width, height, title) {
+        constructImpl(width, height, title);
+        if (options.onReady) {
+            options.onReady();
+        }
+    }
     ~Win32() {
         destructImpl();
     }
 
+    bool ready() const { return !mIsHidden; }
+
+    // Server side scaling is X11 (XRender) only.
+    bool setScaledPresent(const unsigned int width, const unsigned int height,
+                          const ScaleFilter filter = ScaleFilter::Bilinear) {
+        (void)width;
+        (void)height;
+        (void)filter;
+        return false;
+    }
+
+    void clearScaledPresent() {}
+
+    // Frame streaming serves a Unix domain socket and is X11 only.
+    bool startStreaming(const std::string& path) {
+        (void)path;
+        return false;
+    }
+
+    void stopStreaming() {}
+
     void show() {
         if (!mIsHidden) {
             return;
@@ -332,27 +390,97 @@ public:  // WINDOWS
             return;
         }
         WaitForSingleObject(mWindowMutexHandle, INFINITE);
+        if (mHud.shown()) {
+            mHud.draw(framebuffer());
+        }
+        if (mRecorder) {
+            mRecorder->capture(imageView());
+        }
+        const Hud::Clock::time_point start = Hud::Clock::now();
         SetDIBitsToDevice(mDeviceContextHandle, 0, 0, mDataWidth, mDataHeight, 0, 0, 0, mDataHeight, mPixels,
                           &mBitmapInfo, DIB_RGB_COLORS);
+        const std::chrono::steady_clock::rep tagged = takeTaggedInput();
+        if (tagged != 0) {
+            inputPresented(tagged);
+        }
+        mHud.present(Hud::Clock::now() - start);
+        mHud.frame();
+        ReleaseMutex(mWindowMutexHandle);
+    }
+
+    // GDI uploads the whole DIB in one call, so partial presents fall back to a full paint.
+    void paint(const Rect& area) {
+        if (!area.empty()) {
+            paint();
+        }
+    }
+
+    // 32 bit BI_RGB DIBs are B, G, R, X in memory.
+    VisualFormat visualFormat() const { return {24, false, false}; }
+
+    Framebuffer framebuffer() {
+        detachSnapshot();
+        return imageView();
+    }
+
+    Framebuffer imageView() const {
+        return {mPixels, static_cast<int>(mDataWidth), static_cast<int>(mDataHeight), static_cast<int>(mDataWidth)};
+    }
+
+    // The image as last rendered, normally the presented frame, without copying. Call from the
+    // rendering thread; the view stays valid and unchanged however long it is kept.
+    Snapshot snapshot() { return makeSnapshot(imageView()); }
+
+    void setColorTransform(const ColorTransform& transform) {
+        WaitForSingleObject(mWindowMutexHandle, INFINITE);
+        mColorKernel = std::make_unique<ColorKernel>(transform, visualFormat());
+        ReleaseMutex(mWindowMutexHandle);
+    }
+
+    void clearColorTransform() {
+        WaitForSingleObject(mWindowMutexHandle, INFINITE);
+        mColorKernel.reset();
         ReleaseMutex(mWindowMutexHandle);
     }
 
     void render(const uint8_t* data, int width, int height) {
         WaitForSingleObject(mWindowMutexHandle, INFINITE);
+        const Hud::Clock::time_point start = Hud::Clock::now();
+
+        if (mColorKernel) {
+            mColorKernel->convertImage<format::RGB24>(data, width, height, framebuffer());
+        } else {
+            convertImage<format::RGB24, format::XRGB32LE>(data, width, height, framebuffer());
+        }
+
+        mHud.conversion(Hud::Clock::now() - start);
+        ReleaseMutex(mWindowMutexHandle);
+    }
 
-        uint32_t* ndata = mPixels;
+    template <class Src>
+    void renderRows(const uint8_t* data, const size_t stride, const int width, const int y, const int rows,
+                    const Store store = Store::Auto) {
+        WaitForSingleObject(mWindowMutexHandle, INFINITE);
 
-        for (int xy = width * height; xy > 0; --xy) {
-            const uint8_t R = *(data);
-            const uint8_t G = *(data + 1);
-            const uint8_t B = *(data + 2);
-            *(ndata++) = static_cast<uint32_t>(R << 16U) | static_cast<uint32_t>(G << 8U) | B;
-            data += 3;
+        if (mColorKernel) {
+            mColorKernel->convertRows<Src>(data, stride, width, y, rows, framebuffer());
+        } else {
+            convertRows<Src, format::XRGB32LE>(data, stride, width, y, rows, framebuffer(), store);
         }
 
         ReleaseMutex(mWindowMutexHandle);
     }
 
+    void renderIndexed(const uint8_t* data, int width, int height, const Palette& palette) {
+        WaitForSingleObject(mWindowMutexHandle, INFINITE);
+        const Hud::Clock::time_point start = Hud::Clock::now();
+
+        lookupImage(data, width, height, framebuffer(), mPackedPalette.get(palette, visualFormat()));
+
+        mHud.conversion(Hud::Clock::now() - start);
+        ReleaseMutex(mWindowMutexHandle);
+    }
+
 };
 
 };
@@ -8,12 +8,29 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/XShm.h>
+#ifdef CFW_HAVE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
+#ifdef CFW_HAVE_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
 #include <X11/keysym.h>
+#include <poll.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/time.h>
+#if defined(__linux__) && __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include <atomic>
+#include <cmath>
+#include <deque>
 #include <set>
+#include <vector>
+
+#include "stream_server.h"
 
 namespace cfw {
 
@@ -24,6 +41,34 @@ inline void sleep(const unsigned int milliseconds) {
     nanosleep(&tv, nullptr);
 }
 
+// Prefer a NUMA node for the pages of [addr, addr + size): the given one, or else the node of the
+// calling thread. Pages are placed when first touched, so call this on fresh memory. For a shm
+// segment the policy belongs to the segment and also covers the X server's mapping.
+inline bool preferNumaNode(void* const addr, const size_t size, int node = -1) {
+#if defined(__linux__) && __has_include(<linux/mempolicy.h>) && defined(SYS_mbind) && defined(SYS_getcpu)
+    if (node < 0) {
+        unsigned int cpu = 0, current = 0;
+        if (syscall(SYS_getcpu, &cpu, &current, nullptr) != 0) {
+            return false;
+        }
+        node = static_cast<int>(current);
+    }
+    if (node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+        return false;
+    }
+    const unsigned long mask = 1UL << static_cast<unsigned int>(node);
+    const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(addr) + size;
+    return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) == 0;
+#else
+    (void)addr;
+    (void)size;
+    (void)node;
+    return false;
+#endif
+}
+
 namespace {
 constexpr unsigned int keyCodes[] = {
         // clang-format off
@@ -39,49 +84,165 @@ constexpr unsigned int keyCodes[] = {
 
 }; //
 
-class X11 : public WindowBase{
+class X11;
+
+// One display connection with its own event thread and locks. Windows sharing a context are
+// serialized on its Xlib display lock, windows in different contexts are not, so unrelated
+// windows rendered from different threads scale across cores. See WindowOptions::context.
+class DisplayContext {
+    friend class X11;
+
+public:
+    enum class Dispatch {
+        Thread,  // events are handled on the context's own thread
+        Manual,  // no thread, the owner polls fd() and calls dispatch(), see coro.h
+    };
+
 private:
-    class X11Globals {
-    public:
-        std::thread mEventThread;
-        std::mutex mSetupMutex;
-        std::set<X11*> mWins;
-        Display* mDisplay{nullptr};
-        unsigned int mBitDepth{0};
-        std::atomic<bool> mThreadStopSemaphore;
-        bool mIsBGR{false};
-        bool mShmEnabled{false};
-        bool mIsBigEndian{false};
-
-        static X11Globals& ref() {
-            static X11Globals x11;
-            return x11;
-        }
-
-        X11Globals() noexcept : mThreadStopSemaphore(false) { XInitThreads(); }
-
-        ~X11Globals() {
-            mThreadStopSemaphore = true;
+    const Dispatch mDispatch;
+    std::thread mEventThread;
+    std::mutex mSetupMutex;
+    std::recursive_mutex mWinsMutex;  // held while dispatching, so other threads can't destroy windows mid-event
+    std::set<X11*> mWins;
+    Display* mDisplay{nullptr};
+    unsigned int mBitDepth{0};
+    std::atomic<bool> mThreadStopSemaphore;
+    bool mIsBGR{false};
+    bool mIsBigEndian{false};
+    int mShmCompletionType{-1};
+    Atom mDeleteWindowAtom{};  // interned once, a round trip each
+    Atom mProtocolsAtom{};
+#ifdef CFW_HAVE_XINPUT2
+    struct XIScrollValuator {
+        int deviceid;
+        int number;
+        bool vertical;
+        double increment;
+    };
+    int mXIOpcode{-1};
+    std::vector<XIScrollValuator> mXIScroll;
+#endif
+#ifdef CFW_HAVE_XRENDER
+    XRenderPictFormat* mRenderFormat{nullptr};  // of the default visual, null without XRender
+#endif
+
+public:
+    explicit DisplayContext(const Dispatch dispatch = Dispatch::Thread) noexcept
+        : mDispatch(dispatch), mThreadStopSemaphore(false) {
+        XInitThreads();
+    }
+
+    ~DisplayContext() {
+        mThreadStopSemaphore = true;
+        if (mEventThread.joinable()) {
             mEventThread.join();
         }
+        if (mDisplay != nullptr) {
+            XCloseDisplay(mDisplay);
+        }
+    }
 
-        X11Globals(const X11Globals&) = delete;
-        X11Globals(X11Globals&&) = delete;
-        void operator=(const X11Globals&) = delete;
-        void operator=(X11Globals&&) = delete;
-    };
+    // Manual dispatch: the connection to poll for input, -1 until the first window opened it.
+    int fd() const { return mDisplay != nullptr ? ConnectionNumber(mDisplay) : -1; }
+
+    // Manual dispatch: handle every queued event on the calling thread, returns how many.
+    int dispatch();
+
+    // The context of windows created without WindowOptions::context.
+    static const std::shared_ptr<DisplayContext>& shared() {
+        static const std::shared_ptr<DisplayContext> context = std::make_shared<DisplayContext>();
+        return context;
+    }
+
+    DisplayContext(const DisplayContext&) = delete;
+    DisplayContext(DisplayContext&&) = delete;
+    void operator=(const DisplayContext&) = delete;
+    void operator=(DisplayContext&&) = delete;
+};
 
+class X11 : public WindowBase{
+    friend class DisplayContext;
 
+private:
+    std::shared_ptr<DisplayContext> mContext;
     Atom mWindowAtom{};
     Atom mProtocolAtom{};
     ::Window mWindow{};
     XImage* mXImage{};
     uint32_t* mData{};
     std::unique_ptr<XShmSegmentInfo> mShmInfo{};
+    std::atomic<bool> mImageReady{false};  // shm image allocated, see ensureImage()
+    mutable std::mutex mReadyMutex;
+    std::condition_variable mReadyCondition;
+    bool mExposed{false};  // exposed since the last map, guarded by mReadyMutex
+    std::function<void()> mReadyCallback;
+    int mNumaNode{-1};
+    std::atomic<Hud::Clock::rep> mPresentRequested{0};  // paint() time of the put in flight, 0 if none
+    PackedPalette mPackedPalette;
+    std::deque<std::pair<unsigned long, std::chrono::steady_clock::rep>> mTaggedPuts;  // request serial, input arrival
+    std::atomic<uint64_t> mPaintedFrames{0};
+    std::atomic<uint64_t> mPresentedFrames{0};
+    uint64_t mPutFrames{0};                                 // painted frames covered by the last put
+    std::deque<std::pair<unsigned long, uint64_t>> mFramePuts;  // request serial, painted frames
+    std::unique_ptr<StreamServer> mStreamServer;
+#ifdef CFW_HAVE_XINPUT2
+    struct XIValuatorValue {
+        int deviceid;
+        int number;
+        double value;
+    };
+    std::vector<XIValuatorValue> mXIScrollValues;  // last seen scroll valuators, reset on enter
+    bool mXIMoved{false};
+#endif
+#ifdef CFW_HAVE_XRENDER
+    // Scaled present: the image is mDataWidth x mDataHeight, the window mWindowWidth x mWindowHeight.
+    bool mScaled{false};
+    Pixmap mScalePixmap{None};
+    Picture mScaleSource{None};
+    Picture mScaleTarget{None};
+#endif
+    double mScaleX{1.0};  // image pixels per window pixel
+    double mScaleY{1.0};
 
     void handleEvents(const XEvent* const pevent) {
-        Display* const dpy = X11Globals::ref().mDisplay;
+        Display* const dpy = mContext->mDisplay;
         XEvent event = *pevent;
+        if (event.type == mContext->mShmCompletionType) {
+            const Hud::Clock::rep requested = mPresentRequested.exchange(0);
+            if (requested != 0) {
+                mHud.present(Hud::Clock::now() - Hud::Clock::time_point(Hud::Clock::duration(requested)));
+            }
+            while (!mTaggedPuts.empty() && mTaggedPuts.front().first <= event.xany.serial) {
+                inputPresented(mTaggedPuts.front().second);
+                mTaggedPuts.pop_front();
+            }
+            while (!mFramePuts.empty() && mFramePuts.front().first <= event.xany.serial) {
+                mPresentedFrames = mFramePuts.front().second;
+                mFramePuts.pop_front();
+            }
+            return;
+        }
+        mHud.event();
+        switch (event.type) {
+            case KeyPress:
+            case KeyRelease:
+                stampInput(static_cast<uint32_t>(event.xkey.time));
+                break;
+            case ButtonPress:
+            case ButtonRelease:
+                stampInput(static_cast<uint32_t>(event.xbutton.time));
+                break;
+            case MotionNotify:
+                stampInput(static_cast<uint32_t>(event.xmotion.time));
+                break;
+            case EnterNotify:
+            case LeaveNotify:
+                stampInput(static_cast<uint32_t>(event.xcrossing.time));
+                break;
+            case ClientMessage:
+                stampInput(0);
+                break;
+        }
         switch (event.type) {
             case ClientMessage: {
                 if (static_cast<int>(event.xclient.message_type) == static_cast<int>(mProtocolAtom) &&
@@ -90,36 +251,76 @@ private:
                 }
             } break;
             case ConfigureNotify: {
-                while (XCheckWindowEvent(dpy, mWindow, StructureNotifyMask, &event) != 0) {
+                while (XCheckTypedWindowEvent(dpy, mWindow, ConfigureNotify, &event) != 0) {
                 }
                 const int nx = event.xconfigure.x, ny = event.xconfigure.y;
                 if (nx != mWindowPosX || ny != mWindowPosY) {
                     mWindowPosX = nx;
                     mWindowPosY = ny;
                 }
+                const int nw = event.xconfigure.width, nh = event.xconfigure.height;
+                if (nw != static_cast<int>(mWindowWidth) || nh != static_cast<int>(mWindowHeight)) {
+                    mWindowWidth = nw;
+                    mWindowHeight = nh;
+#ifdef CFW_HAVE_XRENDER
+                    if (mScaled) {  // the whole window changes, not only the newly exposed part
+                        updateScaleTransform();
+                        XClearArea(dpy, mWindow, 0, 0, 0, 0, 1);
+                    }
+#endif
+                }
             } break;
             case Expose: {
+                Rect damage{event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height};
                 while (XCheckWindowEvent(dpy, mWindow, ExposureMask, &event) != 0) {
+                    damage = damage.unite({event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height});
                 }
+                markExposed();
 
                 // Paint
-                if (mIsHidden || (mXImage == nullptr)) {
+                if (mIsHidden || !mImageReady) {
+                    return;
+                }
+                damage = damage.intersect(presentBounds());
+                if (damage.empty()) {
                     return;
                 }
 
                 GC gc = DefaultGC(dpy, DefaultScreen(dpy));  // NOLINT
 
-                XShmPutImage(dpy, mWindow, gc, mXImage, 0, 0, 0, 0, mDataWidth, mDataHeight, 1);
+                const std::chrono::steady_clock::rep tagged = takeTaggedInput();
+                if (tagged != 0) {
+                    if (mTaggedPuts.size() >= 64) {  // completions are not arriving, keep the newest
+                        mTaggedPuts.pop_front();
+                    }
+                    mTaggedPuts.emplace_back(NextRequest(dpy), tagged);
+                }
+                const uint64_t painted = mPaintedFrames;
+                if (painted != mPutFrames) {
+                    if (mFramePuts.size() >= 64) {
+                        mFramePuts.pop_front();
+                    }
+                    mFramePuts.emplace_back(NextRequest(dpy), painted);
+                    mPutFrames = painted;
+                }
+#ifdef CFW_HAVE_XRENDER
+                if (mScaled) {
+                    // Upload the image pixels behind the damage, the server scales them into the window.
+                    const Rect source = toImage(damage);
+                    XShmPutImage(dpy, mScalePixmap, gc, mXImage, source.x, source.y, source.x, source.y, source.width,
+                                 source.height, 1);
+                    XRenderComposite(dpy, PictOpSrc, mScaleSource, None, mScaleTarget, damage.x, damage.y, 0, 0,
+                                     damage.x, damage.y, damage.width, damage.height);
+                    break;
+                }
+#endif
+                XShmPutImage(dpy, mWindow, gc, mXImage, damage.x, damage.y, damage.x, damage.y, damage.width,
+                             damage.height, 1);
             } break;
             case ButtonPress: {
                 bool haveMoreEvents = true;
                 do {
-                    mMousePosX = event.xmotion.x;
-                    mMousePosY = event.xmotion.y;
-                    if (mMousePosX < 0 || mMousePosY < 0 || mMousePosX >= static_cast<int>(mDataWidth) ||
-                        mMousePosY >= static_cast<int>(mDataHeight)) {
-                        mMousePosX = mMousePosY = -1;
-                    }
+                    setMousePosition(event.xmotion.x, event.xmotion.y);
                     switch (event.xbutton.button) {
                         case 1:
                             setMouseButtonState(1);
@@ -131,20 +332,16 @@ private:
                             setMouseButtonState(3);
                             break;
                     }
+                    addPointerSample(pointerSample(event.xbutton.x, event.xbutton.y, event.xbutton.time));
                     haveMoreEvents = (XCheckWindowEvent(dpy, mWindow, ButtonPressMask, &event) != 0);
                 } while (haveMoreEvents);
                 dispatchMouseCallback();
+                flushPointerSamples();
             } break;
             case ButtonRelease: {
                 bool haveMoreEvents = true;
                 do {
-                    mMousePosX = event.xmotion.x;
-                    mMousePosY = event.xmotion.y;
-                    if (mMousePosX < 0 || mMousePosY < 0 || mMousePosX >= static_cast<int>(mDataWidth) ||
-                        mMousePosY >= static_cast<int>(mDataHeight)) {
-                        mMousePosX = -1;
-                        mMousePosY = -1;
-                    }
+                    setMousePosition(event.xmotion.x, event.xmotion.y);
                     switch (event.xbutton.button) {
                         case 1:
                             setMouseButtonState(1, false);
@@ -162,9 +359,17 @@ private:
                             setMouseWheelState(-1);
                             break;
                     }
+                    PointerSample sample = pointerSample(event.xbutton.x, event.xbutton.y, event.xbutton.time);
+                    if (!hasSmoothScroll()) {  // otherwise the XInput2 valuators already carry the scrolling
+                        const unsigned int button = event.xbutton.button;
+                        sample.scrollY = button == 4 ? 1.0f : button == 5 ? -1.0f : 0.0f;
+                        sample.scrollX = button == 6 ? -1.0f : button == 7 ? 1.0f : 0.0f;
+                    }
+                    addPointerSample(sample);
                     haveMoreEvents = (XCheckWindowEvent(dpy, mWindow, ButtonReleaseMask, &event) != 0);
                 } while (haveMoreEvents);
                 dispatchMouseCallback();
+                flushPointerSamples();
             } break;
             case KeyPress: {
                 unsigned char chars[32] = {};
@@ -201,12 +406,11 @@ private:
             case EnterNotify: {
                 while (XCheckWindowEvent(dpy, mWindow, EnterWindowMask, &event) != 0) {
                 }
-                mMousePosX = event.xmotion.x;
-                mMousePosY = event.xmotion.y;
-                if (mMousePosX < 0 || mMousePosY < 0 || mMousePosX >= static_cast<int>(mDataWidth) ||
-                    mMousePosY >= static_cast<int>(mDataHeight)) {
-                    mMousePosX = mMousePosY = -1;
-                }
+#ifdef CFW_HAVE_XINPUT2
+                // Scroll valuators are absolute and may have moved while the pointer was elsewhere.
+                mXIScrollValues.clear();
+#endif
+                setMousePosition(event.xmotion.x, event.xmotion.y);
                 dispatchMouseCallback();
             } break;
             case LeaveNotify: {
@@ -216,101 +420,398 @@ private:
                 dispatchMouseCallback();
             } break;
             case MotionNotify: {
-                while (XCheckWindowEvent(dpy, mWindow, PointerMotionMask, &event) != 0) {
-                }
-                mMousePosX = event.xmotion.x;
-                mMousePosY = event.xmotion.y;
-                if (mMousePosX < 0 || mMousePosY < 0 || mMousePosX >= static_cast<int>(mDataWidth) ||
-                    mMousePosY >= static_cast<int>(mDataHeight)) {
-                    mMousePosX = mMousePosY = -1;
-                }
+                // Keep every queued sample for the pointer callback, the mouse callback only gets the last.
+                do {
+                    addPointerSample(pointerSample(event.xmotion.x, event.xmotion.y, event.xmotion.time));
+                } while (XCheckWindowEvent(dpy, mWindow, PointerMotionMask, &event) != 0);
+                setMousePosition(event.xmotion.x, event.xmotion.y);
                 dispatchMouseCallback();
+                flushPointerSamples();
             } break;
         }
     }
 
-    static void* eventThread() {
-        Display* const dpy = X11Globals::ref().mDisplay;
-        XEvent event;
+#ifdef CFW_HAVE_XINPUT2
+    static void initXInput2(DisplayContext& context) {
+        Display* const dpy = context.mDisplay;
+        int opcode = 0, firstEvent = 0, firstError = 0;
+        if (XQueryExtension(dpy, "XInputExtension", &opcode, &firstEvent, &firstError) == 0) {
+            return;
+        }
+        int major = 2, minor = 1;  // 2.1 adds smooth scrolling
+        if (XIQueryVersion(dpy, &major, &minor) != Success) {
+            return;
+        }
+        context.mXIOpcode = opcode;
 
-        for (;;) {
-            int event_flag = XCheckTypedEvent(dpy, ClientMessage, &event);
-            if (event_flag == 0) {
-                event_flag = XCheckMaskEvent(dpy,
-                                             ExposureMask | StructureNotifyMask | ButtonPressMask | KeyPressMask |
-                                             PointerMotionMask | EnterWindowMask | LeaveWindowMask |
-                                             ButtonReleaseMask | KeyReleaseMask,
-                                             &event);
+        int count = 0;
+        XIDeviceInfo* const devices = XIQueryDevice(dpy, XIAllDevices, &count);
+        for (int i = 0; i < count; ++i) {
+            for (int c = 0; c < devices[i].num_classes; ++c) {
+                if (devices[i].classes[c]->type == XIScrollClass) {
+                    const auto* const scroll = reinterpret_cast<const XIScrollClassInfo*>(devices[i].classes[c]);
+                    context.mXIScroll.push_back({devices[i].deviceid, scroll->number,
+                                                 scroll->scroll_type == XIScrollTypeVertical, scroll->increment});
+                }
             }
-            if (event_flag != 0) {
-                for (auto win : X11Globals::ref().mWins) {
-                    if (!win->mIsHidden && event.xany.window == win->mWindow) {
-                        win->handleEvents(&event);
-                    }
+        }
+        XIFreeDeviceInfo(devices);
+    }
+
+    void selectXInput2() {
+        if (mContext->mXIOpcode < 0) {
+            return;
+        }
+        unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {};
+        XISetMask(mask, XI_Motion);
+        XIEventMask eventMask;
+        eventMask.deviceid = XIAllMasterDevices;
+        eventMask.mask_len = sizeof(mask);
+        eventMask.mask = mask;
+        // Replaces core MotionNotify for this window: XI2 motion is subpixel and carries the scroll valuators.
+        XISelectEvents(mContext->mDisplay, mWindow, &eventMask, 1);
+    }
+
+    void handleXIMotion(const XIDeviceEvent* const ev) {
+        mHud.event();
+        stampInput(static_cast<uint32_t>(ev->time));
+        PointerSample sample = pointerSample(ev->event_x, ev->event_y, ev->time);
+
+        const double* value = ev->valuators.values;
+        for (int i = 0; i < ev->valuators.mask_len * 8; ++i) {
+            if (XIMaskIsSet(ev->valuators.mask, i) == 0) {
+                continue;
+            }
+            const double v = *value++;
+            for (const auto& scroll : mContext->mXIScroll) {
+                if (scroll.deviceid != ev->sourceid || scroll.number != i || scroll.increment == 0) {
+                    continue;
+                }
+                auto last = std::find_if(mXIScrollValues.begin(), mXIScrollValues.end(),
+                                         [&](const XIValuatorValue& e) { return e.deviceid == ev->sourceid && e.number == i; });
+                if (last == mXIScrollValues.end()) {
+                    mXIScrollValues.push_back({ev->sourceid, i, v});
+                    continue;
+                }
+                const auto notches = static_cast<float>((v - last->value) / scroll.increment);
+                if (scroll.vertical) {
+                    sample.scrollY -= notches;  // valuators grow downwards, wheel up is positive
+                } else {
+                    sample.scrollX += notches;
                 }
+                last->value = v;
+            }
+        }
+        addPointerSample(sample);
+
+        setMousePosition(ev->event_x, ev->event_y);
+        mXIMoved = true;
+    }
+
+    // Drain all queued XI2 events so each window gets its samples as one batch, false if none.
+    static bool drainXInput2(DisplayContext& context) {
+        Display* const dpy = context.mDisplay;
+        const int opcode = context.mXIOpcode;
+        if (opcode < 0) {
+            return false;
+        }
+        XEvent event;
+        bool drained = false;
+        while (XCheckTypedEvent(dpy, GenericEvent, &event) != 0) {
+            drained = true;
+            if (event.xcookie.extension != opcode || XGetEventData(dpy, &event.xcookie) == 0) {
+                continue;
+            }
+            if (event.xcookie.evtype == XI_Motion) {
+                const auto* const ev = static_cast<const XIDeviceEvent*>(event.xcookie.data);
+                forEachWindow(
+                        context, [ev](X11* win) { return !win->mIsHidden && ev->event == win->mWindow; },
+                        [ev](X11* win) { win->handleXIMotion(ev); });
+            }
+            XFreeEventData(dpy, &event.xcookie);
+        }
+        if (!drained) {
+            return false;
+        }
+        forEachWindow(
+                context, [](X11* win) { return win->mXIMoved; },
+                [](X11* win) {
+                    win->mXIMoved = false;
+                    win->dispatchMouseCallback();
+                    win->flushPointerSamples();
+                });
+        return true;
+    }
+#endif
+
+    bool hasSmoothScroll() const {
+#ifdef CFW_HAVE_XINPUT2
+        return mContext->mXIOpcode >= 0 && !mContext->mXIScroll.empty();
+#else
+        return false;
+#endif
+    }
+
+    // Window to image coordinates, the same unless the present is scaled.
+    void setMousePosition(const double x, const double y) {
+        mMousePosX = static_cast<int_fast16_t>(std::floor(x * mScaleX));
+        mMousePosY = static_cast<int_fast16_t>(std::floor(y * mScaleY));
+        if (mMousePosX < 0 || mMousePosY < 0 || mMousePosX >= static_cast<int>(mDataWidth) ||
+            mMousePosY >= static_cast<int>(mDataHeight)) {
+            mMousePosX = mMousePosY = -1;
+        }
+    }
+
+    PointerSample pointerSample(const double x, const double y, const Time time) const {
+        PointerSample sample;
+        sample.x = static_cast<float>(x * mScaleX);
+        sample.y = static_cast<float>(y * mScaleY);
+        sample.buttons = mMouseButtonState;
+        sample.time = static_cast<uint32_t>(time);
+        sample.arrival = std::chrono::steady_clock::now();
+        return sample;
+    }
+
+    // Call fn on the matching windows of the context with mWinsMutex held, which keeps other
+    // threads from destroying them. A callback may still destroy another window of the context
+    // on this thread, so the set is copied and each window checked again before its turn.
+    template<typename Match, typename Fn>
+    static void forEachWindow(DisplayContext& context, Match match, Fn fn) {
+        std::lock_guard<std::recursive_mutex> lock(context.mWinsMutex);
+        const std::vector<X11*> wins(context.mWins.begin(), context.mWins.end());
+        for (X11* const win : wins) {
+            if (context.mWins.count(win) != 0 && match(win)) {
+                fn(win);
             }
-            if (X11Globals::ref().mThreadStopSemaphore) {
+        }
+    }
+
+    // Handle one queued event of the context, false if there was none.
+    static bool dispatchOne(DisplayContext& context) {
+        Display* const dpy = context.mDisplay;
+#ifdef CFW_HAVE_XINPUT2
+        // Every call, so steady Expose and ShmCompletion traffic can't hold pointer batches back.
+        const bool drained = drainXInput2(context);
+#else
+        const bool drained = false;
+#endif
+        XEvent event;
+        int event_flag = XCheckTypedEvent(dpy, ClientMessage, &event);
+        if (event_flag == 0 && context.mShmCompletionType >= 0) {
+            event_flag = XCheckTypedEvent(dpy, context.mShmCompletionType, &event);
+        }
+        if (event_flag == 0) {
+            event_flag = XCheckMaskEvent(dpy,
+                                         ExposureMask | StructureNotifyMask | ButtonPressMask | KeyPressMask |
+                                         PointerMotionMask | EnterWindowMask | LeaveWindowMask |
+                                         ButtonReleaseMask | KeyReleaseMask,
+                                         &event);
+        }
+        if (event_flag != 0) {
+            forEachWindow(
+                    context, [&event](X11* win) { return !win->mIsHidden && win->isTarget(event.xany.window); },
+                    [&event](X11* win) { win->handleEvents(&event); });
+        }
+        return event_flag != 0 || drained;
+    }
+
+    static void* eventThread(DisplayContext* const context) {
+        for (;;) {
+            const bool handled = dispatchOne(*context);
+            if (context->mThreadStopSemaphore) {
                 break;
             }
-            sleep(8);
+            if (!handled) {  // wake up as soon as the server sends something
+                pollfd fd{ConnectionNumber(context->mDisplay), POLLIN, 0};
+                poll(&fd, 1, 8);
+            }
         }
         return nullptr;
     }
 
+    // Map without waiting, readiness is signalled by the first Expose (see markExposed()).
     void mapWindow() {
-        Display* const dpy = X11Globals::ref().mDisplay;
-        bool is_exposed = false, is_mapped = false;
-        XWindowAttributes attr;
-        XEvent event;
+        Display* const dpy = mContext->mDisplay;
+        {
+            std::lock_guard<std::mutex> lock(mReadyMutex);
+            mExposed = false;
+        }
         XMapRaised(dpy, mWindow);
-        do {  // Wait for the window to be mapped.
-            XWindowEvent(dpy, mWindow, StructureNotifyMask | ExposureMask, &event);
-            switch (event.type) {
-                case MapNotify:
-                    is_mapped = true;
-                    break;
-                case Expose:
-                    is_exposed = true;
-                    break;
+        XFlush(dpy);
+    }
+
+    void waitReady() {
+        if (mContext->mDispatch == DisplayContext::Dispatch::Manual) {
+            while (!ready()) {  // no event thread, pump the connection here
+                if (mContext->dispatch() == 0) {
+                    pollfd fd{mContext->fd(), POLLIN, 0};
+                    poll(&fd, 1, -1);
+                }
             }
-        } while (!is_exposed || !is_mapped);
-        do {  // Wait for the window to be visible.
-            XGetWindowAttributes(dpy, mWindow, &attr);
-            if (attr.map_state != IsViewable) {
-                XSync(dpy, 0);
-                sleep(10);
+            return;
+        }
+        if (std::this_thread::get_id() == mContext->mEventThread.get_id()) {
+            return;  // called from a callback, the event thread cannot deliver the Expose to itself
+        }
+        std::unique_lock<std::mutex> lock(mReadyMutex);
+        mReadyCondition.wait(lock, [this] { return mExposed; });
+    }
+
+    void markExposed() {
+        std::function<void()> callback;
+        {
+            std::lock_guard<std::mutex> lock(mReadyMutex);
+            if (mExposed) {
+                return;
             }
-        } while (attr.map_state != IsViewable);
-        mWindowPosX = attr.x;
-        mWindowPosY = attr.y;
+            mExposed = true;
+            callback = std::move(mReadyCallback);  // only the first time the window becomes ready
+            mReadyCallback = nullptr;
+        }
+        mReadyCondition.notify_all();
+        if (callback) {
+            callback();
+        }
     }
 
-    static int shmErrorHandler(Display* dpy, XErrorEvent* error) {
-        (void)dpy;
-        (void)error;
-        X11Globals::ref().mShmEnabled = false;
-        return 0;
+    // XSetErrorHandler is process-wide, so attaching is serialized across contexts.
+    static std::mutex& shmAttachMutex() {
+        static std::mutex mutex;
+        return mutex;
     }
 
-    void destructImpl() {
-        Display* const dpy = X11Globals::ref().mDisplay;
+    static bool& shmAttached() {
+        static bool attached = false;
+        return attached;
+    }
 
-        auto iter = std::find_if(X11Globals::ref().mWins.begin(), X11Globals::ref().mWins.end(),
-                                 [this](X11* w) { return w == this; });
-        assert(iter != X11Globals::ref().mWins.end());
-        X11Globals::ref().mWins.erase(iter);
+    // Events name the window, except shm completions of a scaled present which name its pixmap.
+    bool isTarget(const XID drawable) const {
+#ifdef CFW_HAVE_XRENDER
+        if (mScaled && drawable == mScalePixmap) {
+            return true;
+        }
+#endif
+        return drawable == mWindow;
+    }
 
-        XDestroyWindow(dpy, mWindow);
-        mWindow = 0;
+    // The image without the copy-on-write of framebuffer(), for reading.
+    Framebuffer imageView() {
+        if (!ensureImage()) {
+            return {};
+        }
+        Framebuffer fb{mData, static_cast<int>(mDataWidth), static_cast<int>(mDataHeight),
+                       mXImage->bytes_per_line / 4};
+        channelShifts(visualFormat(), fb.shiftR, fb.shiftG, fb.shiftB);
+        return fb;
+    }
+
+    // Area of the window the image is presented to, in window coordinates.
+    Rect presentBounds() const {
+#ifdef CFW_HAVE_XRENDER
+        if (mScaled) {
+            return {0, 0, static_cast<int>(mWindowWidth), static_cast<int>(mWindowHeight)};
+        }
+#endif
+        return {0, 0, static_cast<int>(mDataWidth), static_cast<int>(mDataHeight)};
+    }
+
+    // Map a rectangle between image and window coordinates, rounded outwards and grown by one
+    // pixel for the filter taps. Identity unless the present is scaled.
+    static Rect scaleRect(const Rect& r, const int64_t num_w, const int64_t den_w, const int64_t num_h,
+                          const int64_t den_h, const Rect& bounds) {
+        const auto x0 = static_cast<int>(r.x * num_w / den_w) - 1;
+        const auto y0 = static_cast<int>(r.y * num_h / den_h) - 1;
+        const auto x1 = static_cast<int>(((r.x + r.width) * num_w + den_w - 1) / den_w) + 1;
+        const auto y1 = static_cast<int>(((r.y + r.height) * num_h + den_h - 1) / den_h) + 1;
+        return Rect{x0, y0, x1 - x0, y1 - y0}.intersect(bounds);
+    }
+
+    Rect toWindow(const Rect& image) const {
+#ifdef CFW_HAVE_XRENDER
+        if (mScaled) {
+            return scaleRect(image, mWindowWidth, mDataWidth, mWindowHeight, mDataHeight, presentBounds());
+        }
+#endif
+        return image;
+    }
+
+    Rect toImage(const Rect& window) const {
+#ifdef CFW_HAVE_XRENDER
+        if (mScaled) {
+            return scaleRect(window, mDataWidth, mWindowWidth, mDataHeight, mWindowHeight,
+                             {0, 0, static_cast<int>(mDataWidth), static_cast<int>(mDataHeight)});
+        }
+#endif
+        return window;
+    }
+
+#ifdef CFW_HAVE_XRENDER
+    void updateScaleTransform() {
+        mScaleX = static_cast<double>(mDataWidth) / std::max<unsigned int>(1, mWindowWidth);
+        mScaleY = static_cast<double>(mDataHeight) / std::max<unsigned int>(1, mWindowHeight);
+        // Maps window pixels to image pixels, the server samples the image through it.
+        XTransform transform = {{{XDoubleToFixed(mScaleX), XDoubleToFixed(0), XDoubleToFixed(0)},
+                                 {XDoubleToFixed(0), XDoubleToFixed(mScaleY), XDoubleToFixed(0)},
+                                 {XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(1)}}};
+        XRenderSetPictureTransform(mContext->mDisplay, mScaleSource, &transform);
+    }
+
+    void releaseScaledPresent() {
+        if (!mScaled) {
+            return;
+        }
+        Display* const dpy = mContext->mDisplay;
+        XRenderFreePicture(dpy, mScaleTarget);
+        XRenderFreePicture(dpy, mScaleSource);
+        XFreePixmap(dpy, mScalePixmap);
+        mScaleTarget = mScaleSource = None;
+        mScalePixmap = None;
+        mScaled = false;
+        mScaleX = mScaleY = 1.0;
+    }
+#endif
 
+    void releaseImage() {
+        if (!mImageReady) {
+            return;
+        }
+        detachSnapshot();
+        Display* const dpy = mContext->mDisplay;
+        mImageReady = false;
         XShmDetach(dpy, mShmInfo.get());
         XDestroyImage(mXImage);
         shmdt(mShmInfo->shmaddr);
         shmctl(mShmInfo->shmid, IPC_RMID, nullptr);
         mShmInfo.reset();
-
         mData = nullptr;
         mXImage = nullptr;
+    }
+
+    static int shmErrorHandler(Display* dpy, XErrorEvent* error) {
+        (void)dpy;
+        (void)error;
+        shmAttached() = false;
+        return 0;
+    }
+
+    void destructImpl() {
+        Display* const dpy = mContext->mDisplay;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(mContext->mWinsMutex);
+            auto iter = std::find_if(mContext->mWins.begin(), mContext->mWins.end(), [this](X11* w) { return w == this; });
+            assert(iter != mContext->mWins.end());
+            mContext->mWins.erase(iter);
+        }
+
+#ifdef CFW_HAVE_XRENDER
+        releaseScaledPresent();
+#endif
+        XDestroyWindow(dpy, mWindow);
+        mWindow = 0;
+
+        releaseImage();
         XSync(dpy, 0);
 
         delete[] mWindowTitle;
@@ -321,7 +822,8 @@ private:
         dispatchCloseCallback();
     }
 
-    void constructImpl(const unsigned int dimw, const unsigned int dimh, const char* const title = nullptr) {
+    void constructImpl(const unsigned int dimw, const unsigned int dimh, const char* const title,
+                       const WindowOptions& options) {
         if ((dimw == 0u) || (dimh == 0u)) {
             return destructImpl();
         }
@@ -333,9 +835,9 @@ private:
             std::memcpy(tmp_title, nptitle, s * sizeof(char));
         }
 
-        X11Globals::ref().mSetupMutex.lock();
+        mContext->mSetupMutex.lock();
 
-        Display*& dpy = X11Globals::ref().mDisplay;
+        Display*& dpy = mContext->mDisplay;
         if (dpy == nullptr) {
             dpy = XOpenDisplay(nullptr);
             if (dpy == nullptr) {
@@ -343,9 +845,9 @@ private:
                 exit(1);
             }
 
-            X11Globals::ref().mBitDepth = DefaultDepth(dpy, DefaultScreen(dpy));  // NOLINT
-            if (X11Globals::ref().mBitDepth != 8 && X11Globals::ref().mBitDepth != 16 &&
-                X11Globals::ref().mBitDepth != 24 && X11Globals::ref().mBitDepth != 32) {
+            mContext->mBitDepth = DefaultDepth(dpy, DefaultScreen(dpy));  // NOLINT
+            if (mContext->mBitDepth != 8 && mContext->mBitDepth != 16 &&
+                mContext->mBitDepth != 24 && mContext->mBitDepth != 32) {
                 std::cerr << "Invalid screen mode detected (only 8, 16, 24 and "
                              "32 bits "
                              "modes are managed)."
@@ -358,12 +860,29 @@ private:
             int nb_visuals;
             XVisualInfo* vinfo = XGetVisualInfo(dpy, VisualIDMask, &vtemplate, &nb_visuals);  // NOLINT
             if ((vinfo != nullptr) && vinfo->red_mask < vinfo->blue_mask) {
-                X11Globals::ref().mIsBGR = true;
+                mContext->mIsBGR = true;
             }
-            X11Globals::ref().mIsBigEndian = ImageByteOrder(dpy);  // NOLINT
+            mContext->mIsBigEndian = ImageByteOrder(dpy) == MSBFirst;  // NOLINT
             XFree(vinfo);
+            if (XShmQueryExtension(dpy) != 0) {
+                mContext->mShmCompletionType = XShmGetEventBase(dpy) + ShmCompletion;
+            }
+#ifdef CFW_HAVE_XRENDER
+            int renderEvent = 0, renderError = 0;
+            if (XRenderQueryExtension(dpy, &renderEvent, &renderError) != 0) {
+                mContext->mRenderFormat = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, DefaultScreen(dpy)));  // NOLINT
+            }
+#endif
+#ifdef CFW_HAVE_XINPUT2
+            initXInput2(*mContext);
+#endif
 
-            X11Globals::ref().mEventThread = std::thread(eventThread);
+            mContext->mDeleteWindowAtom = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
+            mContext->mProtocolsAtom = XInternAtom(dpy, "WM_PROTOCOLS", 0);
+
+            if (mContext->mDispatch == DisplayContext::Dispatch::Thread) {
+                mContext->mEventThread = std::thread(eventThread, mContext.get());
+            }
         }
 
         mDataWidth = std::min(dimw, static_cast<unsigned int> DisplayWidth(dpy, DefaultScreen(dpy)));    // NOLINT
@@ -372,12 +891,17 @@ private:
         mIsHidden = false;
         mWindowTitle = tmp_title;
 
-        mWindow = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, mDataWidth, mDataHeight, 0, 0L, 0L);  // NOLINT
+        mWindow = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, mDataWidth, mDataHeight, 0, 0L,
+                                      BlackPixel(dpy, DefaultScreen(dpy)));  // NOLINT
 
         XSelectInput(dpy, mWindow,
                      ExposureMask | StructureNotifyMask | ButtonPressMask | KeyPressMask | PointerMotionMask |
                      EnterWindowMask | LeaveWindowMask | ButtonReleaseMask | KeyReleaseMask);
 
+#ifdef CFW_HAVE_XINPUT2
+        selectXInput2();
+#endif
+
         XStoreName(dpy, mWindow, mWindowTitle != nullptr ? mWindowTitle : " ");
 
         static const char* const mWindow_class = "Fluffkiosk";
@@ -390,9 +914,45 @@ private:
         mWindowWidth = mDataWidth;
         mWindowHeight = mDataHeight;
 
+        mWindowAtom = mContext->mDeleteWindowAtom;
+        mProtocolAtom = mContext->mProtocolsAtom;
+        XSetWMProtocols(dpy, mWindow, &mWindowAtom, 1);
+
+        mReadyCallback = options.onReady;
+        mNumaNode = options.numaNode;
+        {
+            std::lock_guard<std::recursive_mutex> lock(mContext->mWinsMutex);
+            mContext->mWins.insert(this);
+        }
+        if (!mIsHidden) {
+            mapWindow();
+        } else {
+            mWindowPosX = mWindowPosY = std::numeric_limits<int>::min();
+        }
+        mContext->mSetupMutex.unlock();
+
+        if (!mIsHidden && !options.async) {
+            waitReady();
+        }
+    }
+
+    // The shm image is created on first use rather than in the constructor, so opening a window
+    // does not allocate, attach or sync. Until then the window shows its black background.
+    bool ensureImage() {
+        if (mImageReady) {
+            return true;
+        }
+        if (mWindow == 0) {
+            return false;
+        }
+        Display* const dpy = mContext->mDisplay;
+        std::lock_guard<std::mutex> lock(shmAttachMutex());
+        if (mImageReady) {
+            return true;
+        }
         assert(XShmQueryExtension(dpy) != 0);  // NOLINT
         mShmInfo = std::make_unique<XShmSegmentInfo>();
-        mXImage = XShmCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), X11Globals::ref().mBitDepth,  // NOLINT
+        mXImage = XShmCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), mContext->mBitDepth,  // NOLINT
                                   ZPixmap, nullptr, mShmInfo.get(), mDataWidth, mDataHeight);
         if (mXImage == nullptr) {
             mShmInfo.reset();
@@ -410,13 +970,15 @@ private:
                     XDestroyImage(mXImage);
                     mShmInfo.reset();
                 } else {
+                    // Nothing has touched the segment yet, so this places all of it.
+                    preferNumaNode(mData, static_cast<size_t>(mXImage->bytes_per_line) * mXImage->height, mNumaNode);
                     mShmInfo->readOnly = 0;
-                    X11Globals::ref().mShmEnabled = true;
+                    shmAttached() = true;
                     XErrorHandler oldXErrorHandler = XSetErrorHandler(shmErrorHandler);
                     XShmAttach(dpy, mShmInfo.get());
                     XSync(dpy, 0);
                     XSetErrorHandler(oldXErrorHandler);
-                    if (!X11Globals::ref().mShmEnabled) {
+                    if (!shmAttached()) {
                         shmdt(mShmInfo->shmaddr);
                         shmctl(mShmInfo->shmid, IPC_RMID, nullptr);
                         XDestroyImage(mXImage);
@@ -426,43 +988,32 @@ private:
             }
         }
         assert(mShmInfo);
-
-        mWindowAtom = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
-        mProtocolAtom = XInternAtom(dpy, "WM_PROTOCOLS", 0);
-        XSetWMProtocols(dpy, mWindow, &mWindowAtom, 1);
-
-        X11Globals::ref().mWins.insert(this);
-        if (!mIsHidden) {
-            mapWindow();
-        } else {
-            mWindowPosX = mWindowPosY = std::numeric_limits<int>::min();
+        if (!mShmInfo) {
+            return false;
         }
-        X11Globals::ref().mSetupMutex.unlock();
-
-        assert(X11Globals::ref().mBitDepth == 24);
-        std::memset(mData, 0, mDataWidth * mDataHeight * 4);
-        paint();
-    }
 
-    static bool isBigEndian() {
-        const int x = 1;
-        return reinterpret_cast<const unsigned char*>(&x)[0] == 0u;
+        // From now on every Expose is answered with a put, so the background must not blank it.
+        XSetWindowBackgroundPixmap(dpy, mWindow, None);
+        mImageReady = true;
+        return true;
     }
 
     void setKey(const unsigned int keycode, const bool isPressed = true) {
-        if (mKeyboardCallback) {
-            for (int i = 0; i < static_cast<int>(Keys::NUM_KEYS); ++i) {
-                if (keyCodes[i] == keycode) {
-                    mKeyboardCallback(static_cast<Keys>(i), isPressed);
-                }
+        for (int i = 0; i < static_cast<int>(Keys::NUM_KEYS); ++i) {
+            if (keyCodes[i] == keycode) {
+                dispatchKeyCallback(static_cast<Keys>(i), isPressed);
             }
         }
     }
 
 public:  /// UNIX
     X11(const unsigned int width, const unsigned int height, const char* const title = nullptr)
-      : WindowBase(width, height, title) {
-        constructImpl(width, height, title);
+      : X11(width, height, title, WindowOptions{}) {}
+
+    X11(const unsigned int width, const unsigned int height, const char* const title, const WindowOptions& options)
+      : WindowBase(width, height, title),
+        mContext(options.context ? options.context : DisplayContext::shared()) {
+        constructImpl(width, height, title, options);
     }
     ~X11() {
         destructImpl();
@@ -471,17 +1022,33 @@ public:  /// UNIX
         if (!mIsHidden) {
             return;
         }
+        mIsHidden = false;  // before mapping, hidden windows get no events
         mapWindow();
-        mIsHidden = false;
+        waitReady();
         paint();
     }
 
+    // Frames handed to paint() and frames the X server finished presenting. Equal when the
+    // window is idle, a render loop can pace itself by waiting for them to meet (see coro.h).
+    uint64_t paintedFrames() const { return mPaintedFrames; }
+    uint64_t presentedFrames() const { return mPresentedFrames; }
+
+    // Mapped and exposed. Always true after a synchronous constructor or show().
+    bool ready() const {
+        std::lock_guard<std::mutex> lock(mReadyMutex);
+        return mExposed;
+    }
+
     void hide() {
         if (mIsHidden) {
             return;
         }
-        Display* const dpy = X11Globals::ref().mDisplay;
+        Display* const dpy = mContext->mDisplay;
         XUnmapWindow(dpy, mWindow);
+        {
+            std::lock_guard<std::mutex> lock(mReadyMutex);
+            mExposed = false;
+        }
         mWindowPosX = mWindowPosY = -1;
         mIsHidden = true;
         dispatchCloseCallback();
@@ -490,7 +1057,7 @@ public:  /// UNIX
     void move(const int posx, const int posy) {
         if (mWindowPosX != posx || mWindowPosY != posy) {
             show();
-            Display* const dpy = X11Globals::ref().mDisplay;
+            Display* const dpy = mContext->mDisplay;
             XMoveWindow(dpy, mWindow, posx, posy);
             mWindowPosX = posx;
             mWindowPosY = posy;
@@ -503,40 +1070,187 @@ public:  /// UNIX
         const unsigned int size = title.size() + 1;
         mWindowTitle = new char[size];  // NOLINT
         std::memcpy(mWindowTitle, title.c_str(), size);
-        Display* const dpy = X11Globals::ref().mDisplay;
+        Display* const dpy = mContext->mDisplay;
         XStoreName(dpy, mWindow, mWindowTitle);
     }
 
-    void paint() {
-        if (mIsHidden || (mXImage == nullptr)) {
+    void paint() { paint({0, 0, static_cast<int>(mDataWidth), static_cast<int>(mDataHeight)}); }
+
+    // Present only the given part of the image, e.g. the damage reported by an overlay.
+    void paint(const Rect& area) {
+        if (mIsHidden || area.empty() || !ensureImage()) {
             return;
         }
-        Display* const dpy = X11Globals::ref().mDisplay;
-        XClearArea(dpy, mWindow, 0, 0, 1, 1, 1);
+        Rect damage = area;
+        if (mHud.shown()) {
+            damage = damage.unite(mHud.draw(framebuffer()));
+            // Keep timing the put already in flight, unless its completion was lost (hidden, coalesced).
+            const Hud::Clock::rep now = Hud::Clock::now().time_since_epoch().count();
+            const Hud::Clock::rep pending = mPresentRequested;
+            if (pending == 0 || Hud::Clock::duration(now - pending) > std::chrono::seconds(1)) {
+                mPresentRequested = now;
+            }
+        }
+        if (mRecorder) {
+            mRecorder->capture(imageView());
+        }
+        if (mStreamServer) {
+            mStreamServer->publish(imageView(), damage, visualFormat());
+        }
+        mHud.frame();
+        Display* const dpy = mContext->mDisplay;
+        damage = toWindow(damage);
+        if (ready()) {  // before the first Expose no put follows, a frame counted here would never present
+            ++mPaintedFrames;
+        }
+        XClearArea(dpy, mWindow, damage.x, damage.y, damage.width, damage.height, 1);
+    }
+
+    // Let the X server scale a width x height image to the window (XRender), so render() and the
+    // shm upload cost the image size instead of the window size, which may also be resized freely.
+    // framebuffer(), render() sizes and mouse positions are in image coordinates from then on.
+    // Returns false if XRender is unavailable.
+    bool setScaledPresent(const unsigned int width, const unsigned int height,
+                          const ScaleFilter filter = ScaleFilter::Bilinear) {
+#ifdef CFW_HAVE_XRENDER
+        if (mContext->mRenderFormat == nullptr || mWindow == 0 || width == 0 || height == 0) {
+            return false;
+        }
+        Display* const dpy = mContext->mDisplay;
+        std::lock_guard<std::recursive_mutex> lock(mContext->mWinsMutex);  // the event thread presents the image
+        releaseScaledPresent();
+        releaseImage();
+        mDataWidth = width;
+        mDataHeight = height;
+
+        mScalePixmap = XCreatePixmap(dpy, mWindow, width, height, mContext->mBitDepth);
+        XRenderPictureAttributes attributes{};
+        attributes.repeat = RepeatPad;  // no dark fringe where the filter samples past the edges
+        mScaleSource = XRenderCreatePicture(dpy, mScalePixmap, mContext->mRenderFormat, CPRepeat, &attributes);
+        mScaleTarget = XRenderCreatePicture(dpy, mWindow, mContext->mRenderFormat, 0, nullptr);
+        XRenderSetPictureFilter(dpy, mScaleSource, filter == ScaleFilter::Bilinear ? FilterBilinear : FilterNearest,
+                                nullptr, 0);
+        mScaled = true;
+        updateScaleTransform();
+        return true;
+#else
+        (void)width;
+        (void)height;
+        (void)filter;
+        return false;
+#endif
+    }
+
+    // Back to presenting 1:1, with the image sized to the window.
+    void clearScaledPresent() {
+#ifdef CFW_HAVE_XRENDER
+        if (!mScaled) {
+            return;
+        }
+        Display* const dpy = mContext->mDisplay;
+        std::lock_guard<std::recursive_mutex> lock(mContext->mWinsMutex);
+        releaseScaledPresent();
+        releaseImage();
+        mDataWidth = std::min<unsigned int>(mWindowWidth, DisplayWidth(dpy, DefaultScreen(dpy)));     // NOLINT
+        mDataHeight = std::min<unsigned int>(mWindowHeight, DisplayHeight(dpy, DefaultScreen(dpy)));  // NOLINT
+#endif
+    }
+
+    // Serve presented frames to local processes on a Unix domain socket at path, sending only
+    // changed tiles, see stream_server.h and stream_client. Start and stop from the thread that paints.
+    bool startStreaming(const std::string& path) {
+        auto server = std::make_unique<StreamServer>(path);
+        const bool ok = server->ok();
+        mStreamServer = ok ? std::move(server) : nullptr;
+        return ok;
+    }
+
+    void stopStreaming() { mStreamServer.reset(); }
+
+    // Client and traffic counters of the running server, nullptr if not streaming.
+    const StreamServer* streamServer() const { return mStreamServer.get(); }
+
+    // Direct access to the shm image, for drawing on top of a rendered frame before paint().
+    Framebuffer framebuffer() {
+        detachSnapshot();
+        return imageView();
+    }
+
+    // The image as last rendered, normally the presented frame, without copying. Call from the
+    // rendering thread; the view stays valid and unchanged however long it is kept.
+    Snapshot snapshot() {
+        if (!ensureImage()) {
+            return {};
+        }
+        return makeSnapshot(imageView());
     }
 
+    VisualFormat visualFormat() const {
+        return {mContext->mBitDepth, mContext->mIsBigEndian, mContext->mIsBGR};
+    }
+
+    // Apply gamma/contrast LUTs or a color matrix inside render() instead of a separate pass.
+    void setColorTransform(const ColorTransform& transform) {
+        mColorKernel = std::make_unique<ColorKernel>(transform, visualFormat());
+    }
+
+    void clearColorTransform() { mColorKernel.reset(); }
+
     void render(const unsigned char* data, int width, int height) {
-        assert(!X11Globals::ref().mIsBGR);
-        auto* ndata = static_cast<unsigned int*>(mData);
+        const Hud::Clock::time_point start = mHud.enabled() ? Hud::Clock::now() : Hud::Clock::time_point{};
+        assert(mContext->mBitDepth == 24);
 
-        static_assert(sizeof(int) == 4);
-        assert(X11Globals::ref().mBitDepth == 24);
+        if (mColorKernel) {
+            mColorKernel->convertImage<format::RGB24>(data, width, height, framebuffer());
+        } else {
+            convertImage<format::RGB24>(data, width, height, framebuffer(), visualFormat());
+        }
 
-        if (X11Globals::ref().mIsBigEndian == isBigEndian()) {
-            for (int xy = width * height; xy > 0; --xy) {
-                *(ndata++) = (*(data) << 16) | (*(data + 1) << 8) | *(data + 2);
-                data += 3;
-            }
+        if (start != Hud::Clock::time_point{}) {
+            mHud.conversion(Hud::Clock::now() - start);
+        }
+    }
+
+    // Render rows [y, y + rows) of a width wide Src image whose rows are stride bytes apart, for
+    // sources that decode a strip at a time (image_source.h). paint() presents them as usual.
+    template <class Src>
+    void renderRows(const uint8_t* data, const size_t stride, const int width, const int y, const int rows,
+                    const Store store = Store::Auto) {
+        assert(mContext->mBitDepth == 24);
+
+        if (mColorKernel) {
+            mColorKernel->convertRows<Src>(data, stride, width, y, rows, framebuffer());
         } else {
-            for (int xy = width * height; xy > 0; --xy) {
-                *(ndata++) = (*(data) << 24) | (*(data + 1) << 16) | (*(data + 2) << 8);
-                data += 3;
-            }
+            convertRows<Src>(data, stride, width, y, rows, framebuffer(), visualFormat(), store);
+        }
+    }
+
+    // Render 8 bit palette indices, one table lookup per pixel. Editing the palette between
+    // frames costs nothing until the next call, which repacks it only if the visual needs it.
+    void renderIndexed(const uint8_t* data, int width, int height, const Palette& palette) {
+        const Hud::Clock::time_point start = mHud.enabled() ? Hud::Clock::now() : Hud::Clock::time_point{};
+        assert(mContext->mBitDepth == 24);
+
+        lookupImage(data, width, height, framebuffer(), mPackedPalette.get(palette, visualFormat()));
+
+        if (start != Hud::Clock::time_point{}) {
+            mHud.conversion(Hud::Clock::now() - start);
         }
     }
 
 };
 
+inline int DisplayContext::dispatch() {
+    if (mDisplay == nullptr) {
+        return 0;
+    }
+    int handled = 0;
+    while (X11::dispatchOne(*this)) {
+        ++handled;
+    }
+    return handled;
+}
+
 }; //ns
 
 #endif //CFW_X11_H